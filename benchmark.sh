@@ -0,0 +1,63 @@
+#!/bin/bash
+#
+# End-to-end throughput benchmark: generates a synthetic workspace (unless
+# it already exists) and times feature-data, descriptor-PCA and
+# feature-patches on it, reporting rows/sec and peak RSS of each.
+# Each tool's per-stage trace is written to workspace/TOOL-trace.json.
+#
+# usage: benchmark.sh [build-dir] [workspace] [images] [keypoints-per-image]
+#
+
+BUILD=$(cd ${1:-build} && pwd) || exit 1
+WS=${2:-synthetic-ws}
+IMAGES=${3:-200}
+KEYPOINTS=${4:-2000}
+MAX_PATCHES=100000
+
+# GNU time (gtime on macOS) reports wall clock time and peak RSS with -v
+if command -v gtime > /dev/null; then
+    TIME="gtime -v"
+elif /usr/bin/time -v true > /dev/null 2>&1; then
+    TIME="/usr/bin/time -v"
+else
+    echo "GNU time is required (brew install gnu-time)"
+    exit 1
+fi
+
+for TOOL in synthetic-workspace feature-data descriptor-PCA feature-patches; do
+    if [ ! -x $BUILD/$TOOL ]; then
+        echo "$BUILD/$TOOL not found"
+        exit 1
+    fi
+done
+
+if [ ! -f $WS/database.db ]; then
+    $BUILD/synthetic-workspace -n $IMAGES -k $KEYPOINTS $WS || exit 1
+fi
+
+LOG=$(mktemp)
+trap "rm -f $LOG" EXIT
+
+# run NAME COMMAND... : runs the command and reports its throughput
+# in rows of the features CSV, which every stage reads or writes
+run() {
+    NAME=$1
+    shift
+    $TIME "$@" > /dev/null 2> $LOG || { cat $LOG; exit 1; }
+    ELAPSED=$(grep "Elapsed (wall clock)" $LOG | awk '{print $NF}')
+    SECONDS_=$(echo $ELAPSED | awk -F: '{ s = 0; for (i = 1; i <= NF; i++) s = 60*s + $i; print s }')
+    RSS=$(grep "Maximum resident set size" $LOG | awk '{print $NF}')
+    ROWS=$(($(wc -l < $CSV) - 1))
+    printf "%-16s %10s rows %8.2f s %12.0f rows/s %8.1f MB peak RSS\n" \
+           $NAME $ROWS $SECONDS_ $(echo "$ROWS $SECONDS_" | awk '{print ($2 > 0 ? $1/$2 : 0)}') \
+           $(echo $RSS | awk '{print $1/1024}')
+}
+
+CSV=$(cd $WS && pwd)/features.csv
+run feature-data $BUILD/feature-data -t $WS/feature-data-trace.json $WS $CSV
+
+# descriptor-PCA writes lambda.txt to the current directory
+(cd $WS && run descriptor-PCA $BUILD/descriptor-PCA -t descriptor-PCA-trace.json $CSV) || exit 1
+
+mkdir -p $WS/patches
+run feature-patches $BUILD/feature-patches -t $WS/feature-patches-trace.json $CSV $WS/images $MAX_PATCHES $WS/patches/atlas
@@ -0,0 +1,102 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <unistd.h>
+#include <colmap/base/database.h>
+#include "match-graph.h"
+#include "instrumentation.h"
+
+//
+// Builds the match graph file (see match-graph.h) of a COLMAP database
+// with one scan of its matches and one of its two view geometries. With
+// -i the match index pairs are stored too, which feature-data -g needs
+// to count matches per keypoint.
+//
+int main(int argc, char *argv[]) {
+    bool withMatchIndices = false;
+
+    auto usage = [&]() {
+        std::cerr << "usage: " << argv[0] << " [-i] [-t trace.json] database.db match-graph.bin\n";
+        exit(-1);
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "it:")) != -1) {
+        switch (opt) {
+        case 'i': withMatchIndices = true; break;
+        case 't': enableTrace(optarg); break;
+        default: usage();
+        }
+    }
+    if (argc - optind != 2)
+        usage();
+
+    const std::string databasePath(argv[optind]);
+    const std::string graphPath(argv[optind+1]);
+
+    std::ifstream databaseFile(databasePath);
+    if (!databaseFile.is_open()) {
+        std::cerr << "Database '" << databasePath << "' does not exist!\n";
+        exit(-1);
+    }
+    databaseFile.close();
+    colmap::Database database(databasePath);
+
+    auto toMatches = [](const colmap::FeatureMatches& featureMatches) {
+        std::vector<MatchGraph::Match> matches(featureMatches.size());
+        for (size_t i = 0; i < featureMatches.size(); i++)
+            matches[i] = {uint32_t(featureMatches[i].point2D_idx1), uint32_t(featureMatches[i].point2D_idx2)};
+        return matches;
+    };
+
+    MatchGraphBuilder builder(withMatchIndices);
+    {
+        TraceStage stage("database read");
+        for (auto&& image : database.ReadAllImages())
+            builder.AddImage(image.ImageId());
+
+        //
+        // Raw matches and inlier matches, joined on the pair id.
+        //
+        struct PairMatches {
+            std::vector<MatchGraph::Match> matches, inliers;
+        };
+        std::unordered_map<colmap::image_pair_t, PairMatches> pairs;
+        size_t numMatches = 0, numInliers = 0;
+        for (auto&& kv : database.ReadAllMatches()) {
+            pairs[kv.first].matches = toMatches(kv.second);
+            numMatches += kv.second.size();
+        }
+        std::vector<colmap::image_pair_t> pairIds;
+        std::vector<colmap::TwoViewGeometry> geometries;
+        database.ReadTwoViewGeometries(&pairIds, &geometries);
+        for (size_t i = 0; i < pairIds.size(); i++) {
+            pairs[pairIds[i]].inliers = toMatches(geometries[i].inlier_matches);
+            numInliers += geometries[i].inlier_matches.size();
+        }
+
+        for (auto&& kv : pairs) {
+            colmap::image_t imageId1, imageId2;
+            colmap::Database::PairIdToImagePair(kv.first, &imageId1, &imageId2);
+            builder.AddPair(imageId1, imageId2, kv.second.matches, kv.second.inliers);
+        }
+        stage.AddRows(numMatches + numInliers);
+        std::cout << pairs.size() << " matched pairs, " << numMatches << " matches, "
+                  << numInliers << " inlier matches\n";
+    }
+
+    {
+        TraceStage stage("write");
+        if (!builder.Write(graphPath)) {
+            std::cerr << "Unable to write '" << graphPath << "'!\n";
+            exit(-1);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,216 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <random>
+#include <algorithm>
+#include <unistd.h>
+#include "feature-reader.h"
+#include "matchability-model.h"
+#include "pq-index.h"
+#include "instrumentation.h"
+
+//
+// Builds an IVF-PQ index (see pq-index.h) of the descriptors of a
+// features CSV, projected with the PCA basis written by descriptor-PCA.
+// A first pass reservoir samples descriptors to train the coarse
+// centroids and the codebooks; a second pass encodes every descriptor
+// in parallel. Descriptors are identified by their N.
+//
+int main(int argc, char *argv[]) {
+    size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t blockRows = 1 << 16;
+    int dims = 32;
+    int numSubspaces = 8;
+    int numLists = 1024;
+    size_t numSamples = 200000;
+    int iterations = 10;
+
+    auto usage = [&]() {
+        std::cerr << "usage: " << argv[0] << " [-j threads] [-b block-rows] [-d dims] [-m code-bytes] "
+                  << "[-l lists] [-s samples] [-i iterations] [-t trace.json] "
+                  << "pca-basis.bin features.csv index.bin\n";
+        exit(-1);
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:b:d:m:l:s:i:t:")) != -1) {
+        switch (opt) {
+        case 'j': numThreads = std::max(1, std::atoi(optarg)); break;
+        case 'b': blockRows = std::max(1, std::atoi(optarg)); break;
+        case 'd': dims = std::atoi(optarg); break;
+        case 'm': numSubspaces = std::atoi(optarg); break;
+        case 'l': numLists = std::max(1, std::atoi(optarg)); break;
+        case 's': numSamples = size_t(std::max(1, std::atoi(optarg))); break;
+        case 'i': iterations = std::max(1, std::atoi(optarg)); break;
+        case 't': enableTrace(optarg); break;
+        default: usage();
+        }
+    }
+    if (argc - optind != 3)
+        usage();
+    if (dims < 1 || dims > 128 || numSubspaces < 1 || dims % numSubspaces != 0) {
+        std::cerr << "dims must be in 1..128 and a multiple of the code bytes\n";
+        exit(-1);
+    }
+
+    const std::string basisPath(argv[optind]);
+    const std::string featuresCSV(argv[optind+1]);
+    const std::string indexPath(argv[optind+2]);
+
+    DescriptorBasis basis;
+    if (!basis.Read(basisPath)) {
+        std::cerr << "Unable to read PCA basis '" << basisPath << "'\n";
+        exit(-1);
+    }
+    PQQuantizer quantizer;
+    quantizer.dims = dims;
+    quantizer.numLists = numLists;
+    quantizer.numSubspaces = numSubspaces;
+    quantizer.pcaMean = basis.mean;
+    quantizer.pcaComponents.assign(basis.components.begin(), basis.components.begin() + size_t(dims)*128);
+
+    //
+    // Streams the CSV once. Each block is parsed in parallel, work(t) runs
+    // on every thread's share (in threadRows[t]), and then merge() runs on
+    // the main thread, which sees the shares in file order.
+    //
+    std::vector<std::vector<FeatureRow>> threadRows(numThreads);
+    auto pass = [&](const char* name, auto&& work, auto&& merge) {
+        FeatureReader reader(featuresCSV);
+        if (!reader.IsOpen()) {
+            std::cerr << "Unable to open '" << featuresCSV << "'\n";
+            exit(-1);
+        }
+        TraceStage stage(name);
+        FeatureBlock block;
+        size_t total = 0;
+        while (size_t n = reader.ReadBlock(block, blockRows)) {
+            auto chunk = [&](size_t t) {
+                const size_t begin = n * t / numThreads;
+                const size_t end = n * (t + 1) / numThreads;
+                std::vector<FeatureRow>& rows = threadRows[t];
+                rows.resize(end - begin);
+                size_t m = 0;
+                for (size_t i = begin; i < end; i++)
+                    if (parseFeatureRow(block.LineBegin(i), block.LineEnd(i), rows[m]))
+                        m++;
+                rows.resize(m);
+                work(t);
+            };
+            std::vector<std::thread> threads;
+            for (size_t t = 1; t < numThreads; t++)
+                threads.emplace_back(chunk, t);
+            chunk(0);
+            for (auto&& thread : threads)
+                thread.join();
+            merge();
+            total += n;
+            std::cout << "\r" << name << ": " << total << " rows" << std::flush;
+        }
+        std::cout << "\n";
+        stage.AddRows(total);
+        stage.AddBytes(reader.BytesRead());
+    };
+
+    //
+    // Reservoir sample of the descriptors.
+    //
+    std::vector<uint8_t> sampled;
+    {
+        size_t seen = 0;
+        std::mt19937_64 rng(1);
+        pass("sample", [](size_t) {}, [&]() {
+            for (auto&& rows : threadRows) {
+                for (auto&& row : rows) {
+                    size_t slot = seen++;
+                    if (slot >= numSamples) {
+                        slot = std::uniform_int_distribution<size_t>(0, seen - 1)(rng);
+                        if (slot >= numSamples) continue;
+                    } else {
+                        sampled.resize((slot + 1) * 128);
+                    }
+                    std::copy(row.descriptor, row.descriptor + 128, sampled.data() + slot*128);
+                }
+            }
+        });
+    }
+    const size_t n = sampled.size() / 128;
+    if (n < size_t(std::max(numLists, 256))) {
+        std::cerr << "Need at least " << std::max(numLists, 256) << " descriptors to train, have " << n << "\n";
+        exit(-1);
+    }
+
+    {
+        TraceStage stage("train");
+        std::vector<float> samples(n * dims);
+        for (size_t i = 0; i < n; i++)
+            quantizer.Project(sampled.data() + i*128, samples.data() + i*dims);
+        sampled.clear();
+        sampled.shrink_to_fit();
+        std::cout << "training " << numLists << " lists and " << numSubspaces << " x 256 codebooks on "
+                  << n << " samples..." << std::endl;
+        trainPQQuantizer(quantizer, samples.data(), n, iterations, numThreads);
+        stage.AddRows(n);
+    }
+
+    //
+    // Encoding pass: the threads encode their share of a block, then the
+    // codes are appended to the lists in file order.
+    //
+    struct Encoded {
+        std::vector<uint32_t> lists;
+        std::vector<uint8_t> codes;
+    };
+    std::vector<Encoded> encoded(numThreads);
+    std::vector<std::vector<uint32_t>> ids(numLists);
+    std::vector<std::vector<uint8_t>> codes(numLists);
+    pass("encode", [&](size_t t) {
+        const std::vector<FeatureRow>& rows = threadRows[t];
+        Encoded& e = encoded[t];
+        e.lists.resize(rows.size());
+        e.codes.resize(rows.size() * numSubspaces);
+        std::vector<float> x(dims);
+        for (size_t i = 0; i < rows.size(); i++) {
+            quantizer.Project(rows[i].descriptor, x.data());
+            const int list = quantizer.Assign(x.data());
+            quantizer.Encode(x.data(), list, e.codes.data() + i*numSubspaces);
+            e.lists[i] = uint32_t(list);
+        }
+    }, [&]() {
+        for (size_t t = 0; t < numThreads; t++) {
+            const std::vector<FeatureRow>& rows = threadRows[t];
+            const Encoded& e = encoded[t];
+            for (size_t i = 0; i < rows.size(); i++) {
+                if (rows[i].num < 0 || rows[i].num >= int64_t(UINT32_MAX)) {
+                    std::cerr << "Feature N " << rows[i].num << " does not fit a 32 bit id\n";
+                    exit(-1);
+                }
+                const uint32_t list = e.lists[i];
+                ids[list].push_back(uint32_t(rows[i].num));
+                codes[list].insert(codes[list].end(), e.codes.begin() + i*numSubspaces,
+                                   e.codes.begin() + (i + 1)*numSubspaces);
+            }
+        }
+    });
+
+    {
+        TraceStage stage("write");
+        if (!writePQIndex(indexPath, quantizer, ids, codes)) {
+            std::cerr << "Unable to write '" << indexPath << "'!\n";
+            exit(-1);
+        }
+        size_t total = 0, largest = 0;
+        for (auto&& list : ids) {
+            total += list.size();
+            largest = std::max(largest, list.size());
+        }
+        stage.AddRows(total);
+        std::cout << "wrote " << total << " codes of " << numSubspaces << " bytes to " << indexPath
+                  << " (largest list " << largest << ")\n";
+    }
+
+    return 0;
+}
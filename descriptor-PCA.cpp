@@ -3,7 +3,13 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <limits>
+#include <unistd.h>
 #include <Eigen/Dense>
+#include "instrumentation.h"
+#include "matchability-model.h"
+#include "feature-reader.h"
+#include "npy-writer.h"
 
 std::vector<std::string> split(const std::string& str, char delim) {
     std::vector<std::string> strings;
@@ -28,18 +34,32 @@ std::string trim(const std::string& str,  const std::string& whitespace = " \t\n
 }
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        std::cerr << "usage : " << argv[0] << " descriptors.csv XXX\n";
+    std::string projectedNpy;
+
+    auto usage = [&]() {
+        std::cerr << "usage : " << argv[0] << " [-n projected.npy] [-t trace.json] descriptors.csv\n";
         exit(1);
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+        switch (opt) {
+        case 'n': projectedNpy = optarg; break;
+        case 't': enableTrace(optarg); break;
+        default: usage();
+        }
     }
+    if (argc - optind < 1)
+        usage();
 
-    const std::string featuresCSV(argv[1]);
+    const std::string featuresCSV(argv[optind]);
 
     std::vector<int> matchCounts;
     std::vector<std::string> descriptorStrings;
 
     std::cout << "reading descriptors..." << std::endl;
     {
+        TraceStage stage("parse");
         std::ifstream is(featuresCSV);
         if (!is.is_open()) {
             std::cerr << "Unable to open '" << featuresCSV << "'\n";
@@ -51,6 +71,7 @@ int main(int argc, char *argv[]) {
         
         std::string line;
         while (std::getline(is, line)) {
+            stage.AddBytes(line.size() + 1);
             if ((k++ % skip) != 0) continue;
             if (line.length() <= 0 || line.at(0) == '#') continue;
             std::vector<std::string> str = split(line, ',');
@@ -64,7 +85,7 @@ int main(int argc, char *argv[]) {
                 continue;
             }
         }
-
+        stage.AddRows(k);
     }
 
     const size_t N = descriptorStrings.size();
@@ -73,26 +94,41 @@ int main(int argc, char *argv[]) {
     
     std::cout << "creating 128x" << N << " descriptor matrix..." << std::endl;
     Eigen::Matrix<double,128,Eigen::Dynamic> descriptors(128,N); 
-    for (size_t i = 0; i < N; i++) {
-        const std::string hexstr = descriptorStrings[i];
-        assert(hexstr.length() == 128*2);
-        for (size_t j = 0; j < 128; j++) {
-            const std::string s = hexstr.substr(2*j,2);
-            const int h = std::stoi(s, nullptr, 16);
-            descriptors(j,i) = double(h);
+    {
+        TraceStage stage("descriptor decode");
+        for (size_t i = 0; i < N; i++) {
+            const std::string hexstr = descriptorStrings[i];
+            assert(hexstr.length() == 128*2);
+            for (size_t j = 0; j < 128; j++) {
+                const std::string s = hexstr.substr(2*j,2);
+                const int h = std::stoi(s, nullptr, 16);
+                descriptors(j,i) = double(h);
+            }
         }
+        stage.AddRows(N);
     }
 
     descriptorStrings.clear();
 
     std::cout << "creating 128x128 covariance matrix..." << std::endl;
-    Eigen::Matrix<double,128,1> mean = descriptors.rowwise().mean();
-    Eigen::Matrix<double,128,Eigen::Dynamic> A = descriptors.colwise() - mean; // 128 x N
-    Eigen::Matrix<double,128,128> covariance = 1.0/(N-1) * A * A.transpose();  // 128 x 128
+    Eigen::Matrix<double,128,1> mean;
+    Eigen::Matrix<double,128,Eigen::Dynamic> A; // 128 x N
+    Eigen::Matrix<double,128,128> covariance;   // 128 x 128
+    {
+        TraceStage stage("covariance");
+        mean = descriptors.rowwise().mean();
+        A = descriptors.colwise() - mean;
+        covariance = 1.0/(N-1) * A * A.transpose();
+        stage.AddRows(N);
+    }
 
     
     std::cout << "Eigen analysis..." << std::endl;
-    Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double,128,128>> eigenSolver(covariance);
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double,128,128>> eigenSolver;
+    {
+        TraceStage stage("eigen solve");
+        eigenSolver.compute(covariance);
+    }
     Eigen::Matrix<double,128,1> lambda = eigenSolver.eigenvalues().reverse();
 
     {
@@ -113,6 +149,76 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    //
+    // The basis (mean and components by decreasing eigenvalue) for
+    // projecting descriptors, e.g. by train-matchability.
+    //
+    {
+        const std::string basisName = "pca-basis.bin";
+        DescriptorBasis basis;
+        basis.mean.resize(128);
+        basis.components.resize(128*128);
+        basis.eigenvalues.resize(128);
+        for (size_t i = 0; i < 128; i++) {
+            basis.mean[i] = float(mean(i));
+            basis.eigenvalues[i] = float(lambda(i));
+            for (size_t j = 0; j < 128; j++)
+                basis.components[i*128 + j] = float(eigenSolver.eigenvectors()(j, 127 - i));
+        }
+        if (!basis.Write(basisName)) {
+            std::cerr << "Unable to write '" << basisName << "'!\n";
+            exit(-1);
+        }
+    }
+
+    //
+    // With -n every descriptor of the CSV (not just the sampled ones) is
+    // projected onto the first M components and streamed to a
+    // float32[N,M] NumPy array, row for row with the CSV. Malformed rows
+    // get a row of NaNs, so that the rows still line up.
+    //
+    if (!projectedNpy.empty()) {
+        TraceStage stage("npy write");
+        Eigen::Matrix<float,M,128> Y;   // M x 128 principal components
+        Eigen::Matrix<float,128,1> meanf = mean.cast<float>();
+        for (size_t k = 0; k < M; k++)
+            Y.row(k) = eigenSolver.eigenvectors().col(127 - k).transpose().cast<float>();
+
+        FeatureReader reader(featuresCSV);
+        NpyWriter npy(projectedNpy, "<f4", M);
+        if (!reader.IsOpen() || !npy.IsOpen()) {
+            std::cerr << "Unable to write '" << projectedNpy << "'!\n";
+            exit(-1);
+        }
+        FeatureBlock block;
+        FeatureRow row;
+        Eigen::Matrix<float,M,Eigen::Dynamic> projected;
+        size_t malformed = 0;
+        while (size_t n = reader.ReadBlock(block, 1 << 16)) {
+            projected.resize(M, n);
+            for (size_t i = 0; i < n; i++) {
+                if (!parseFeatureRow(block.LineBegin(i), block.LineEnd(i), row)) {
+                    projected.col(i).setConstant(std::numeric_limits<float>::quiet_NaN());
+                    malformed++;
+                    continue;
+                }
+                const Eigen::Map<const Eigen::Matrix<uint8_t,128,1>> d(row.descriptor);
+                projected.col(i) = Y * (d.cast<float>() - meanf);
+            }
+            npy.Append(projected.data(), n);   // column-major M x n is row-major n x M
+            stage.AddRows(n);
+        }
+        stage.AddBytes(reader.BytesRead());
+        if (malformed > 0)
+            std::cerr << "warning: " << malformed << " malformed rows in '" << featuresCSV
+                      << "' were written as NaN rows to '" << projectedNpy << "'\n";
+        if (!npy.Close()) {
+            std::cerr << "Unable to write '" << projectedNpy << "'!\n";
+            exit(-1);
+        }
+        std::cout << "wrote " << npy.Rows() << "x" << M << " projected descriptors to " << projectedNpy << "\n";
+    }
+
     // Eigen::Matrix<double,128,128> X = eigenSolver.eigenvectors().rowwise().reverse();
     // Eigen::Matrix<double,128,Eigen::Dynamic> Y = X.block(0,0,128,M); // 128 x M principal components
     // Eigen::MatrixXd C = Y.transpose() * A;  // (M x 128) * (128 x N) -> M x N
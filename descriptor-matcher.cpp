@@ -0,0 +1,129 @@
+#include "descriptor-matcher.h"
+#include <algorithm>
+#include <climits>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+void NearestNeighbors::Reset(size_t n) {
+	best.assign(n, 0);
+	distance1.assign(n, INT32_MAX);
+	distance2.assign(n, INT32_MAX);
+}
+
+void descriptorNorms(const uint8_t* descriptors, size_t n, int32_t* norms) {
+	for (size_t i = 0; i < n; i++) {
+		const uint8_t* d = descriptors + i*128;
+		int32_t sum = 0;
+		for (int c = 0; c < 128; c++)
+			sum += int32_t(d[c]) * int32_t(d[c]);
+		norms[i] = sum;
+	}
+}
+
+namespace {
+
+constexpr size_t tileRows = 4;      // rows of a per tile
+constexpr size_t blockRows = 256;   // rows of b per block (32KB)
+
+inline void update(NearestNeighbors& nn, size_t i, uint32_t j, int32_t distance) {
+	if (distance < nn.distance1[i]) {
+		nn.distance2[i] = nn.distance1[i];
+		nn.distance1[i] = distance;
+		nn.best[i] = j;
+	} else if (distance < nn.distance2[i]) {
+		nn.distance2[i] = distance;
+	}
+}
+
+#if defined(__AVX2__)
+//
+// The horizontal sums of four vectors.
+//
+inline __m128i horizontalSums(__m256i v0, __m256i v1, __m256i v2, __m256i v3) {
+	const __m256i s = _mm256_hadd_epi32(_mm256_hadd_epi32(v0, v1), _mm256_hadd_epi32(v2, v3));
+	return _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+}
+#endif
+
+//
+// Dot products of the first rows (<= tileRows) rows of a with every row
+// of the block [b0,b1) of b.
+//
+void tileDotProducts(const uint8_t* a, size_t rows, const uint8_t* b, size_t b0, size_t b1,
+                     int32_t dots[][blockRows]) {
+#if defined(__AVX2__)
+	// the tile is widened to 16 bits once and then reused for the whole block
+	alignas(32) int16_t tile[tileRows][128] = {};
+	for (size_t r = 0; r < rows; r++)
+		for (int k = 0; k < 8; k++)
+			_mm256_store_si256(reinterpret_cast<__m256i*>(tile[r] + 16*k),
+				_mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + r*128 + 16*k))));
+	for (size_t j = b0; j < b1; j++) {
+		const uint8_t* d = b + j*128;
+		__m256i sum0 = _mm256_setzero_si256(), sum1 = sum0, sum2 = sum0, sum3 = sum0;
+		for (int k = 0; k < 8; k++) {
+			const __m256i dk = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(d + 16*k)));
+			sum0 = _mm256_add_epi32(sum0, _mm256_madd_epi16(dk, _mm256_load_si256(reinterpret_cast<const __m256i*>(tile[0] + 16*k))));
+			sum1 = _mm256_add_epi32(sum1, _mm256_madd_epi16(dk, _mm256_load_si256(reinterpret_cast<const __m256i*>(tile[1] + 16*k))));
+			sum2 = _mm256_add_epi32(sum2, _mm256_madd_epi16(dk, _mm256_load_si256(reinterpret_cast<const __m256i*>(tile[2] + 16*k))));
+			sum3 = _mm256_add_epi32(sum3, _mm256_madd_epi16(dk, _mm256_load_si256(reinterpret_cast<const __m256i*>(tile[3] + 16*k))));
+		}
+		alignas(16) int32_t sums[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(sums), horizontalSums(sum0, sum1, sum2, sum3));
+		for (size_t r = 0; r < tileRows; r++)
+			dots[r][j - b0] = sums[r];
+	}
+#else
+	for (size_t r = 0; r < rows; r++) {
+		const uint8_t* ar = a + r*128;
+		for (size_t j = b0; j < b1; j++) {
+			const uint8_t* d = b + j*128;
+			int32_t sum = 0;
+			for (int c = 0; c < 128; c++)
+				sum += int32_t(ar[c]) * int32_t(d[c]);
+			dots[r][j - b0] = sum;
+		}
+	}
+#endif
+}
+
+} // namespace
+
+void nearestNeighbors(const uint8_t* a, const int32_t* aNorms, size_t na,
+                      const uint8_t* b, const int32_t* bNorms, size_t nb,
+                      NearestNeighbors& ab, NearestNeighbors& ba) {
+	ab.Reset(na);
+	ba.Reset(nb);
+	int32_t dots[tileRows][blockRows];
+	for (size_t b0 = 0; b0 < nb; b0 += blockRows) {
+		const size_t b1 = std::min(nb, b0 + blockRows);
+		for (size_t a0 = 0; a0 < na; a0 += tileRows) {
+			const size_t rows = std::min(tileRows, na - a0);
+			tileDotProducts(a + a0*128, rows, b, b0, b1, dots);
+			for (size_t r = 0; r < rows; r++) {
+				// a's neighbours are tracked in registers for the block
+				const size_t i = a0 + r;
+				int32_t distance1 = ab.distance1[i], distance2 = ab.distance2[i];
+				uint32_t best = ab.best[i];
+				for (size_t j = b0; j < b1; j++) {
+					const int32_t distance = aNorms[i] + bNorms[j] - 2*dots[r][j - b0];
+					if (distance < distance2) {
+						if (distance < distance1) {
+							distance2 = distance1;
+							distance1 = distance;
+							best = uint32_t(j);
+						} else {
+							distance2 = distance;
+						}
+					}
+					if (distance < ba.distance2[j])
+						update(ba, j, uint32_t(i), distance);
+				}
+				ab.distance1[i] = distance1;
+				ab.distance2[i] = distance2;
+				ab.best[i] = best;
+			}
+		}
+	}
+}
@@ -0,0 +1,43 @@
+#ifndef DESCRIPTOR_MATCHER_H
+#define DESCRIPTOR_MATCHER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//
+// The two nearest neighbours of each descriptor of a set in another set,
+// by squared L2 distance. If the other set has fewer than two
+// descriptors the missing distances are INT32_MAX.
+//
+struct NearestNeighbors {
+	std::vector<uint32_t> best;
+	std::vector<int32_t> distance1, distance2;
+
+	void Reset(size_t n);
+
+	// Lowe's ratio test on the (non-squared) distances.
+	bool PassesRatioTest(size_t i, double ratio) const {
+		return double(distance1[i]) < ratio * ratio * double(distance2[i]);
+	}
+};
+
+//
+// Squared norms of n 128 byte descriptors.
+//
+void descriptorNorms(const uint8_t* descriptors, size_t n, int32_t* norms);
+
+//
+// Brute force two nearest neighbour search between descriptor sets a and
+// b (n x 128 bytes each, with their squared norms), in both directions
+// at once: ab gets the neighbours in b of each descriptor of a and ba the
+// neighbours in a of each descriptor of b. Distances come from
+// |a|^2 + |b|^2 - 2 a.b with an integer (AVX2 when available) dot
+// product kernel, tiled so that a block of b stays in cache while tiles
+// of a sweep over it.
+//
+void nearestNeighbors(const uint8_t* a, const int32_t* aNorms, size_t na,
+                      const uint8_t* b, const int32_t* bNorms, size_t nb,
+                      NearestNeighbors& ab, NearestNeighbors& ba);
+
+#endif // DESCRIPTOR_MATCHER_H
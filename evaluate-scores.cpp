@@ -0,0 +1,351 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <algorithm>
+#include <unistd.h>
+#include "feature-reader.h"
+#include "instrumentation.h"
+
+//
+// Score histogram of the positives and negatives of one label. Scores
+// are binned on [0,1], so curves and areas are exact up to the bin
+// width and memory does not grow with the number of keypoints.
+//
+struct ScoreHistogram {
+    std::vector<uint64_t> positives, negatives;
+
+    explicit ScoreHistogram(int bins = 0) : positives(bins), negatives(bins) {}
+
+    int Bins() const { return int(positives.size()); }
+
+    void Add(float score, bool positive) {
+        const int bins = Bins();
+        const int b = std::min(bins - 1, std::max(0, int(score * bins)));
+        (positive ? positives : negatives)[b]++;
+    }
+
+    void Merge(const ScoreHistogram& other) {
+        for (int b = 0; b < Bins(); b++) {
+            positives[b] += other.positives[b];
+            negatives[b] += other.negatives[b];
+        }
+    }
+
+    uint64_t Positives() const { return sum(positives); }
+    uint64_t Negatives() const { return sum(negatives); }
+
+    //
+    // Area under the ROC curve: the probability that a positive scores
+    // higher than a negative, counting ties (same bin) as half.
+    //
+    double ROCArea() const {
+        const double P = Positives(), N = Negatives();
+        if (P == 0 || N == 0) return NAN;
+        double area = 0, positivesAbove = 0;
+        for (int b = Bins() - 1; b >= 0; b--) {
+            area += negatives[b] * (positivesAbove + 0.5 * positives[b]);
+            positivesAbove += positives[b];
+        }
+        return area / (P * N);
+    }
+
+    //
+    // Area under the PR curve as average precision: the precision at each
+    // threshold weighted by the recall it adds.
+    //
+    double PRArea() const {
+        const double P = Positives();
+        if (P == 0) return NAN;
+        double area = 0, tp = 0, fp = 0;
+        for (int b = Bins() - 1; b >= 0; b--) {
+            tp += positives[b];
+            fp += negatives[b];
+            if (positives[b] > 0)
+                area += positives[b] / P * tp / (tp + fp);
+        }
+        return area;
+    }
+
+    //
+    // Precision and threshold at the highest threshold reaching the recall.
+    //
+    std::pair<double,double> PrecisionAtRecall(double recall) const {
+        const double P = Positives();
+        double tp = 0, fp = 0;
+        for (int b = Bins() - 1; b >= 0; b--) {
+            tp += positives[b];
+            fp += negatives[b];
+            if (P > 0 && tp / P >= recall)
+                return {tp / (tp + fp), double(b) / Bins()};
+        }
+        return {NAN, NAN};
+    }
+
+    //
+    // THRESHOLD,TP,FP,TPR,FPR,PRECISION at every bin boundary that
+    // changes the counts.
+    //
+    void WriteCurves(std::ostream& os) const {
+        const double P = Positives(), N = Negatives();
+        os << "THRESHOLD,TP,FP,TPR,FPR,PRECISION\n";
+        uint64_t tp = 0, fp = 0;
+        for (int b = Bins() - 1; b >= 0; b--) {
+            if (positives[b] == 0 && negatives[b] == 0) continue;
+            tp += positives[b];
+            fp += negatives[b];
+            os << double(b) / Bins() << "," << tp << "," << fp << ","
+               << (P > 0 ? tp / P : 0) << "," << (N > 0 ? fp / N : 0) << ","
+               << double(tp) / (tp + fp) << "\n";
+        }
+    }
+
+private:
+    static uint64_t sum(const std::vector<uint64_t>& counts) {
+        uint64_t total = 0;
+        for (uint64_t count : counts) total += count;
+        return total;
+    }
+};
+
+constexpr int numLabels = 3;
+const char* labelNames[numLabels] = {"matches", "inliers", "has3D"};
+const char* labelColumns[numLabels] = {"MATCHES", "INLIERS", "HASPT3D"};
+
+bool labelOf(const FeatureRow& row, int label) {
+    switch (label) {
+    case 0: return row.matches > 0;
+    case 1: return row.inlierMatches > 0;
+    default: return row.hasPoint3D;
+    }
+}
+
+struct ImageStats {
+    std::string name;
+    uint64_t keypoints = 0;
+    std::vector<ScoreHistogram> histograms;
+};
+
+//
+// Evaluates the scores of a scores CSV (N,SCORE, as written by
+// score-features) against the labels of the features CSV they were
+// computed from: ROC and PR areas and the precision at a given recall,
+// overall and per image, for each of the labels MATCHES>0, INLIERS>0
+// and HASPT3D. Rows are joined on N; features without a score are
+// skipped. Writes PREFIX-LABEL-curves.csv for each label and
+// PREFIX-images.csv with the per image areas.
+//
+int main(int argc, char *argv[]) {
+    size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t blockRows = 1 << 16;
+    int bins = 10000;
+    int imageBins = 100;
+    double recall = 0.9;
+
+    auto usage = [&]() {
+        std::cerr << "usage: " << argv[0] << " [-j threads] [-b block-rows] [-B bins] [-I image-bins] "
+                  << "[-r recall] [-t trace.json] features.csv scores.csv output-prefix\n";
+        exit(-1);
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:b:B:I:r:t:")) != -1) {
+        switch (opt) {
+        case 'j': numThreads = std::max(1, std::atoi(optarg)); break;
+        case 'b': blockRows = std::max(1, std::atoi(optarg)); break;
+        case 'B': bins = std::max(2, std::atoi(optarg)); break;
+        case 'I': imageBins = std::max(2, std::atoi(optarg)); break;
+        case 'r': recall = std::atof(optarg); break;
+        case 't': enableTrace(optarg); break;
+        default: usage();
+        }
+    }
+    if (argc - optind != 3)
+        usage();
+
+    const std::string featuresCSV(argv[optind]);
+    const std::string scoresCSV(argv[optind+1]);
+    const std::string prefix(argv[optind+2]);
+
+    FeatureReader reader(featuresCSV);
+    if (!reader.IsOpen()) {
+        std::cerr << "Unable to open '" << featuresCSV << "'\n";
+        exit(-1);
+    }
+    std::ifstream scoresFile(scoresCSV);
+    if (!scoresFile.is_open()) {
+        std::cerr << "Unable to open '" << scoresCSV << "'\n";
+        exit(-1);
+    }
+
+    //
+    // Next N,SCORE row of the scores CSV; false at the end.
+    //
+    std::string line;
+    auto nextScore = [&](int64_t& num, float& score) {
+        while (std::getline(scoresFile, line)) {
+            char* end;
+            num = std::strtoll(line.c_str(), &end, 10);
+            if (end == line.c_str() || *end != ',') continue;   // header or malformed
+            score = std::strtof(end + 1, nullptr);
+            return true;
+        }
+        return false;
+    };
+    int64_t scoreNum = -1;
+    float score = 0;
+    bool haveScore = nextScore(scoreNum, score);
+
+    std::vector<ScoreHistogram> histograms(numLabels, ScoreHistogram(bins));
+    std::map<uint32_t, ImageStats> images;
+
+    struct ThreadState {
+        std::vector<ScoreHistogram> histograms;
+        std::map<uint32_t, ImageStats> images;
+        size_t malformed = 0;
+    };
+    std::vector<ThreadState> states(numThreads);
+    for (auto&& state : states)
+        state.histograms.assign(numLabels, ScoreHistogram(bins));
+
+    FeatureBlock block;
+    std::vector<FeatureRow> rows;
+    std::vector<char> valid;
+    std::vector<float> scores;
+    size_t total = 0, scored = 0;
+
+    auto parallel = [&](auto&& work) {
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < numThreads; t++)
+            threads.emplace_back(work, t);
+        work(0);
+        for (auto&& thread : threads)
+            thread.join();
+    };
+
+    TraceStage evaluateStage("evaluate");
+    while (size_t n = reader.ReadBlock(block, blockRows)) {
+        rows.resize(n);
+        valid.resize(n);
+        scores.resize(n);
+
+        parallel([&](size_t t) {
+            for (size_t i = n * t / numThreads; i < n * (t + 1) / numThreads; i++) {
+                valid[i] = parseFeatureRow(block.LineBegin(i), block.LineEnd(i), rows[i]);
+                if (!valid[i]) states[t].malformed++;
+            }
+        });
+
+        // join on N; both files are in feature order
+        for (size_t i = 0; i < n; i++) {
+            if (!valid[i]) continue;
+            while (haveScore && scoreNum < rows[i].num)
+                haveScore = nextScore(scoreNum, score);
+            if (haveScore && scoreNum == rows[i].num) {
+                scores[i] = score;
+                scored++;
+            } else {
+                valid[i] = false;
+            }
+        }
+
+        parallel([&](size_t t) {
+            ThreadState& state = states[t];
+            for (size_t i = n * t / numThreads; i < n * (t + 1) / numThreads; i++) {
+                if (!valid[i]) continue;
+                const FeatureRow& row = rows[i];
+                ImageStats& image = state.images[row.imageId];
+                if (image.histograms.empty()) {
+                    image.name = std::string(row.imageName);
+                    image.histograms.assign(numLabels, ScoreHistogram(imageBins));
+                }
+                image.keypoints++;
+                for (int label = 0; label < numLabels; label++) {
+                    const bool positive = labelOf(row, label);
+                    state.histograms[label].Add(scores[i], positive);
+                    image.histograms[label].Add(scores[i], positive);
+                }
+            }
+        });
+
+        // the per image stats of a block are few (rows are grouped by image)
+        for (auto&& state : states) {
+            for (auto&& kv : state.images) {
+                ImageStats& image = images[kv.first];
+                if (image.histograms.empty()) {
+                    image.name = kv.second.name;
+                    image.histograms.assign(numLabels, ScoreHistogram(imageBins));
+                }
+                image.keypoints += kv.second.keypoints;
+                for (int label = 0; label < numLabels; label++)
+                    image.histograms[label].Merge(kv.second.histograms[label]);
+            }
+            state.images.clear();
+        }
+
+        total += n;
+        traceCounter("rows", n);
+        std::cout << "\r" << total << " rows evaluated" << std::flush;
+    }
+    std::cout << "\n";
+    evaluateStage.AddRows(total);
+    evaluateStage.AddBytes(reader.BytesRead());
+
+    size_t malformed = 0;
+    for (auto&& state : states) {
+        malformed += state.malformed;
+        for (int label = 0; label < numLabels; label++)
+            histograms[label].Merge(state.histograms[label]);
+    }
+    if (malformed > 0)
+        std::cerr << "warning: " << malformed << " malformed rows skipped\n";
+    if (scored < total - malformed)
+        std::cerr << "warning: " << (total - malformed - scored) << " rows without a score skipped\n";
+
+    TraceStage writeStage("write");
+    std::cout << scored << " scored keypoints in " << images.size() << " images\n";
+    for (int label = 0; label < numLabels; label++) {
+        const ScoreHistogram& histogram = histograms[label];
+        const auto precision = histogram.PrecisionAtRecall(recall);
+        std::cout << labelNames[label] << ": "
+                  << histogram.Positives() << " positives, "
+                  << "ROC AUC " << histogram.ROCArea() << ", "
+                  << "PR AUC " << histogram.PRArea() << ", "
+                  << "precision " << precision.first << " at recall " << recall
+                  << " (threshold " << precision.second << ")\n";
+
+        const std::string curvesName = prefix + "-" + labelNames[label] + "-curves.csv";
+        std::ofstream os(curvesName);
+        if (!os.is_open()) {
+            std::cerr << "Unable to open '" << curvesName << "' for writing!\n";
+            exit(-1);
+        }
+        histogram.WriteCurves(os);
+    }
+
+    const std::string imagesName = prefix + "-images.csv";
+    std::ofstream os(imagesName);
+    if (!os.is_open()) {
+        std::cerr << "Unable to open '" << imagesName << "' for writing!\n";
+        exit(-1);
+    }
+    os << "IMGID,IMGNAME,KEYPOINTS";
+    for (int label = 0; label < numLabels; label++)
+        os << "," << labelColumns[label] << "," << labelColumns[label] << "_ROC_AUC," << labelColumns[label] << "_PR_AUC";
+    os << "\n";
+    for (auto&& kv : images) {
+        const ImageStats& image = kv.second;
+        os << kv.first << "," << image.name << "," << image.keypoints;
+        for (auto&& histogram : image.histograms)
+            os << "," << histogram.Positives() << "," << histogram.ROCArea() << "," << histogram.PRArea();
+        os << "\n";
+    }
+    writeStage.AddRows(images.size());
+
+    return 0;
+}
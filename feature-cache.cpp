@@ -0,0 +1,95 @@
+#include "feature-cache.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+
+uint64_t mixFingerprint(uint64_t seed, uint64_t value) {
+	// splitmix64 finalizer of the combination
+	uint64_t z = seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+uint64_t fileFingerprint(const std::string& path) {
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+		return 0;
+	// nanoseconds, since rewriting a database often keeps its size
+#ifdef __APPLE__
+	const struct timespec& mtime = st.st_mtimespec;
+#else
+	const struct timespec& mtime = st.st_mtim;
+#endif
+	return mixFingerprint(mixFingerprint(uint64_t(st.st_size), uint64_t(mtime.tv_sec)), uint64_t(mtime.tv_nsec));
+}
+
+namespace {
+
+template <class T>
+void writeValue(std::ofstream& os, const T& value) {
+	os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <class T>
+bool readValue(std::ifstream& is, T& value) {
+	return bool(is.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+} // namespace
+
+bool FeatureCache::Read(const std::string& path) {
+	images.clear();
+	if (!read(path)) {
+		images.clear();
+		return false;
+	}
+	return true;
+}
+
+bool FeatureCache::read(const std::string& path) {
+	std::ifstream is(path, std::ios::binary);
+	char magic[4];
+	uint32_t version, numImages;
+	if (!is.read(magic, 4) || std::memcmp(magic, "FCFC", 4) != 0 ||
+		!readValue(is, version) || version != 1 ||
+		!readValue(is, databaseFingerprint) || !readValue(is, modelFingerprint) ||
+		!readValue(is, numImages))
+		return false;
+	images.reserve(numImages);
+	for (uint32_t k = 0; k < numImages; k++) {
+		uint32_t imageId, numLabels;
+		Image image;
+		if (!readValue(is, imageId) || !readValue(is, image.fingerprint) ||
+			!readValue(is, image.numKeypoints) || !readValue(is, numLabels) || numLabels > image.numKeypoints)
+			return false;
+		image.labels.resize(numLabels);
+		if (!is.read(reinterpret_cast<char*>(image.labels.data()), numLabels * sizeof(Label)))
+			return false;
+		images.emplace(imageId, std::move(image));
+	}
+	return true;
+}
+
+bool FeatureCache::Write(const std::string& path) const {
+	const std::string temporary = path + ".tmp";
+	{
+		std::ofstream os(temporary, std::ios::binary);
+		if (!os.is_open()) return false;
+		os.write("FCFC", 4);
+		writeValue<uint32_t>(os, 1);
+		writeValue(os, databaseFingerprint);
+		writeValue(os, modelFingerprint);
+		writeValue<uint32_t>(os, images.size());
+		for (auto&& kv : images) {
+			writeValue<uint32_t>(os, kv.first);
+			writeValue(os, kv.second.fingerprint);
+			writeValue(os, kv.second.numKeypoints);
+			writeValue<uint32_t>(os, kv.second.labels.size());
+			os.write(reinterpret_cast<const char*>(kv.second.labels.data()), kv.second.labels.size() * sizeof(Label));
+		}
+		if (!os) return false;
+	}
+	return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,66 @@
+#ifndef FEATURE_CACHE_H
+#define FEATURE_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//
+// Fingerprints: 64 bit hashes that change when what they summarize
+// changes. mixFingerprint is order dependent; summing mixed values is
+// an order independent way to fingerprint a set.
+//
+uint64_t mixFingerprint(uint64_t seed, uint64_t value);
+
+// Size and nanosecond modification time of a file (0 if it does not exist).
+uint64_t fileFingerprint(const std::string& path);
+
+//
+// The labels feature-data computed for each image on a previous run,
+// for incremental runs (-c). Only keypoints with a non zero label are
+// stored. An image is reused as long as its fingerprint -- its keypoint
+// count, matched pairs and registered keypoints -- is unchanged; the
+// database and model fingerprints let a rerun on unchanged inputs skip
+// computing the image fingerprints altogether.
+//
+// The file format is little-endian binary:
+//
+//   char[4]  "FCFC"
+//   uint32   version (1)
+//   uint64   databaseFingerprint, modelFingerprint
+//   uint32   numImages
+//   per image: uint32 imageId, uint64 fingerprint, uint32 numKeypoints,
+//              uint32 numLabels, Label labels[numLabels]
+//
+struct FeatureCache {
+	struct Label {
+		uint32_t index;
+		uint32_t matches;
+		uint32_t inlierMatches;
+		uint32_t hasPoint3D;
+	};
+
+	struct Image {
+		uint64_t fingerprint = 0;
+		uint32_t numKeypoints = 0;
+		std::vector<Label> labels;   // by increasing index
+	};
+
+	uint64_t databaseFingerprint = 0;
+	uint64_t modelFingerprint = 0;
+	std::unordered_map<uint32_t, Image> images;
+
+	// Leaves no images if the file is missing, truncated or corrupt.
+	bool Read(const std::string& path);
+
+	// Writes to a temporary file renamed over path, so that an
+	// interrupted run leaves the previous cache intact.
+	bool Write(const std::string& path) const;
+
+private:
+	bool read(const std::string& path);
+};
+
+#endif // FEATURE_CACHE_H
@@ -8,7 +8,14 @@
 #include <set>
 #include <map>
 #include <algorithm>
+#include <limits>
+#include <memory>
+#include <unistd.h>
 #include "reconstruction.h"
+#include "instrumentation.h"
+#include "match-graph.h"
+#include "feature-cache.h"
+#include "npy-writer.h"
 #include <colmap/base/point3d.h>
 #include <colmap/base/database.h>
 #include <Eigen/Dense>
@@ -20,14 +27,77 @@ bool fileExists(std::string fname) { // note: https://en.wikipedia.org/wiki/Time
     return is.good();
 };
 
+//
+// A partition of the images for distributed runs: an image id range
+// (-r first-last) and/or one of K hash partitions (-p k/K). A partitioned
+// run writes only its images' rows, still numbered with the global N of
+// a full run, plus a FEATURES.csv.images sidecar with the N offset,
+// keypoint count and label counts of each image and the total N of the
+// full run, which merge-feature-data uses to put the partials back
+// together and to check that none is missing.
+//
+struct ImagePartition {
+    colmap::image_t first = 0, last = std::numeric_limits<colmap::image_t>::max();
+    uint32_t index = 0, count = 1;
+
+    bool Partitioned() const {
+        return first != 0 || last != std::numeric_limits<colmap::image_t>::max() || count != 1;
+    }
+
+    bool Contains(colmap::image_t imageId) const {
+        const uint32_t hash = uint32_t(imageId) * 2654435761u;   // Knuth's multiplicative hash
+        return imageId >= first && imageId <= last && (hash >> 16) % count == index;
+    }
+};
+
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        std::cerr << "usage: " << argv[0] << " SfM_folder feature-labels.csv\n";
+    std::string graphPath;
+    std::string cachePath;
+    std::string npyPrefix;
+    ImagePartition partition;
+
+    auto usage = [&]() {
+        std::cerr << "usage: " << argv[0] << " [-g match-graph.bin] [-r first-last] [-p k/K] [-c cache.bin] [-n npy-prefix] "
+                  << "[-t trace.json] "
+                  << "SfM_folder feature-labels.csv\n";
+        exit(1);
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "g:r:p:c:n:t:")) != -1) {
+        switch (opt) {
+        case 'g': graphPath = optarg; break;
+        case 'c': cachePath = optarg; break;
+        case 'n': npyPrefix = optarg; break;
+        case 'r':
+            if (std::sscanf(optarg, "%u-%u", &partition.first, &partition.last) != 2 ||
+                partition.first > partition.last)
+                usage();
+            break;
+        case 'p':
+            if (std::sscanf(optarg, "%u/%u", &partition.index, &partition.count) != 2 ||
+                partition.count == 0 || partition.index >= partition.count)
+                usage();
+            break;
+        case 't': enableTrace(optarg); break;
+        default: usage();
+        }
+    }
+    if (argc - optind != 2)
+        usage();
+    if (!npyPrefix.empty() && partition.Partitioned()) {
+        // merge-feature-data merges the CSVs only
+        std::cerr << "-n cannot be combined with -r or -p\n";
         exit(1);
     }
-    
-    const std::string SfM = argv[1];
-    const std::string featureLabelsCSV = argv[2];
+    if (!cachePath.empty() && graphPath.empty()) {
+        // the image fingerprints need each pair's raw match and inlier counts
+        std::cerr << "-c requires -g match-graph.bin\n";
+        exit(1);
+    }
+
+    const std::string SfM = argv[optind];
+    const std::string featureLabelsCSV = argv[optind+1];
 
     //
     // Open input database and harvest keypoint info.
@@ -40,7 +110,12 @@ int main(int argc, char *argv[]) {
     }
     colmap::Database database(databasePath);
 
-    std::vector<colmap::Image> images = database.ReadAllImages();
+    std::vector<colmap::Image> images;
+    {
+        TraceStage stage("database read");
+        images = database.ReadAllImages();
+        stage.AddRows(images.size());
+    }
 
     std::string reconstructionPath = SfM + "/sparse/0";
     if (!fileExists(reconstructionPath + "/cameras.bin") ||
@@ -49,20 +124,109 @@ int main(int argc, char *argv[]) {
         std::cerr << "Reconstruction '" << reconstructionPath << "' does not exist!\n";
         exit(-1);
     }
-    Reconstruction reconstruction;
-    reconstruction.ReadBinary(reconstructionPath);
-
     std::set<KeypointIndex> keypointsWith3DPoints;
-    for (auto&& kv : reconstruction.images) {
-        const auto& image = kv.second;
-        const colmap::point2D_t numPoints2D = image.NumPoints2D();
-        for (colmap::point2D_t point2d_idx = 0; point2d_idx < numPoints2D; point2d_idx++) {
-            const colmap::Point2D& point2d = image.Point2D(point2d_idx);
-            if (point2d.HasPoint3D())
-                keypointsWith3DPoints.insert(std::make_pair(image.ImageId(), point2d_idx));
+    {
+        TraceStage stage("reconstruction load");
+        Reconstruction reconstruction;
+        reconstruction.ReadBinary(reconstructionPath);
+
+        for (auto&& kv : reconstruction.images) {
+            const auto& image = kv.second;
+            const colmap::point2D_t numPoints2D = image.NumPoints2D();
+            for (colmap::point2D_t point2d_idx = 0; point2d_idx < numPoints2D; point2d_idx++) {
+                const colmap::Point2D& point2d = image.Point2D(point2d_idx);
+                if (point2d.HasPoint3D())
+                    keypointsWith3DPoints.insert(std::make_pair(image.ImageId(), point2d_idx));
+            }
+        }
+        stage.AddRows(reconstruction.points3D.size());
+    }
+
+    MatchGraph graph;
+    if (!graphPath.empty()) {
+        if (!graph.Open(graphPath)) {
+            std::cerr << "Unable to open match graph '" << graphPath << "'\n";
+            exit(-1);
+        }
+        if (!graph.HasMatchIndices()) {
+            std::cerr << "Match graph '" << graphPath << "' has no match indices (build it with -i)\n";
+            exit(-1);
+        }
+    }
+
+    //
+    // Incremental runs (-c, with -g): an image whose fingerprint --
+    // keypoint count, matched pairs with their raw and inlier matches
+    // from the match graph, and registered keypoints -- is the one
+    // in the cache reuses the cached labels; only the other (dirty)
+    // images get their matches counted. If the database, the match graph
+    // and the model are unchanged and the cache has every image, the
+    // image fingerprints are not even computed.
+    //
+    const bool incremental = !cachePath.empty();
+    FeatureCache cache, newCache;
+    std::set<colmap::image_t> dirtyImages;
+    if (incremental) {
+        TraceStage stage("fingerprints");
+        newCache.databaseFingerprint = mixFingerprint(fileFingerprint(databasePath), fileFingerprint(graphPath));
+        newCache.modelFingerprint = mixFingerprint(mixFingerprint(
+            fileFingerprint(reconstructionPath + "/cameras.bin"),
+            fileFingerprint(reconstructionPath + "/images.bin")),
+            fileFingerprint(reconstructionPath + "/points3D.bin"));
+        const bool haveCache = cache.Read(cachePath);
+        bool unchanged = haveCache &&
+            cache.databaseFingerprint == newCache.databaseFingerprint &&
+            cache.modelFingerprint == newCache.modelFingerprint;
+        for (auto&& image : images)
+            if (partition.Contains(image.ImageId()) && cache.images.count(image.ImageId()) == 0)
+                unchanged = false;
+
+        std::map<colmap::image_t,uint64_t> pairFingerprints, registrationFingerprints;
+        if (!unchanged) {
+            // sums, so that the order of pairs, matches and keypoints does not matter
+            auto matchesFingerprint = [](const MatchGraph::Match* begin, const MatchGraph::Match* end) {
+                uint64_t fingerprint = 0;
+                for (const MatchGraph::Match* match = begin; match != end; match++)
+                    fingerprint += mixFingerprint(match->point2D_idx1, match->point2D_idx2);
+                return fingerprint;
+            };
+            for (size_t a = 0; a < graph.NumImages(); a++)
+                for (const MatchGraph::Edge* edge = graph.EdgesBegin(a); edge != graph.EdgesEnd(a); edge++)
+                    pairFingerprints[graph.ImageId(a)] += mixFingerprint(mixFingerprint(
+                        graph.ImageId(edge->neighbor),
+                        matchesFingerprint(graph.MatchesBegin(edge->pair), graph.MatchesEnd(edge->pair))),
+                        matchesFingerprint(graph.InliersBegin(edge->pair), graph.InliersEnd(edge->pair)));
+            for (auto&& k : keypointsWith3DPoints)
+                registrationFingerprints[k.first] += mixFingerprint(0, k.second);
+        }
+
+        size_t reused = 0;
+        for (auto&& image : images) {
+            const colmap::image_t imageId = image.ImageId();
+            if (!partition.Contains(imageId)) continue;
+            FeatureCache::Image& entry = newCache.images[imageId];
+            if (unchanged) {
+                entry.fingerprint = cache.images.at(imageId).fingerprint;
+            } else {
+                const size_t numKeypoints = database.NumKeypointsForImage(imageId);
+                entry.fingerprint = mixFingerprint(mixFingerprint(numKeypoints,
+                    pairFingerprints[imageId]), registrationFingerprints[imageId]);
+            }
+            auto iter = cache.images.find(imageId);
+            if (!haveCache || iter == cache.images.end() || iter->second.fingerprint != entry.fingerprint)
+                dirtyImages.insert(imageId);
+            else
+                reused++;
         }
+        std::cout << "incremental: " << reused << " images cached, " << dirtyImages.size() << " to recompute\n";
+        stage.AddRows(images.size());
     }
 
+    // images whose matches are counted in this run
+    auto counted = [&](colmap::image_t imageId) {
+        return partition.Contains(imageId) && (!incremental || dirtyImages.count(imageId) > 0);
+    };
+
     std::map<KeypointIndex,size_t> matchCounts;
     std::map<KeypointIndex,size_t> inlierMatchCounts;
 
@@ -75,23 +239,52 @@ int main(int argc, char *argv[]) {
         }
     };
 
-    for (auto&& imageA : images) {
-        for (auto&& imageB : images) {
-            if (imageA.ImageId() >= imageB.ImageId()) continue;
-            if (!database.ExistsMatches(imageA.ImageId(),imageB.ImageId())) continue;
-            const colmap::FeatureMatches matches = database.ReadMatches(imageA.ImageId(),imageB.ImageId());
-            for (auto&& match : matches) {
-                const KeypointIndex keypointA = std::make_pair(imageA.ImageId(),match.point2D_idx1);
-                increment(matchCounts, keypointA);
+    //
+    // With a match graph (from build-match-graph -i) the matches are
+    // counted from its memory mapped match indices instead of per pair
+    // database queries.
+    //
+    if (!graphPath.empty()) {
+        TraceStage stage("match counting");
+        size_t numMatches = 0;
+        for (size_t a = 0; a < graph.NumImages(); a++) {
+            const colmap::image_t imageIdA = graph.ImageId(a);
+            if (!counted(imageIdA)) continue;
+            for (const MatchGraph::Edge* edge = graph.EdgesBegin(a); edge != graph.EdgesEnd(a); edge++) {
+                if (edge->neighbor < a) continue;   // each pair once, from its smaller image id
+                for (const MatchGraph::Match* match = graph.MatchesBegin(edge->pair); match != graph.MatchesEnd(edge->pair); match++)
+                    increment(matchCounts, std::make_pair(imageIdA, colmap::point2D_t(match->point2D_idx1)));
+                for (const MatchGraph::Match* match = graph.InliersBegin(edge->pair); match != graph.InliersEnd(edge->pair); match++)
+                    increment(inlierMatchCounts, std::make_pair(imageIdA, colmap::point2D_t(match->point2D_idx1)));
+                numMatches += edge->matches + edge->inliers;
             }
-            if (!database.ExistsInlierMatches(imageA.ImageId(),imageB.ImageId())) continue;
-            const colmap::TwoViewGeometry twoViewGeometry = database.ReadTwoViewGeometry(imageA.ImageId(),imageB.ImageId());
-            const colmap::FeatureMatches& inlierMatches = twoViewGeometry.inlier_matches;
-            for (auto&& match : inlierMatches) {
-                const KeypointIndex keypointA = std::make_pair(imageA.ImageId(),match.point2D_idx1);
-                increment(inlierMatchCounts, keypointA);
+        }
+        stage.AddRows(numMatches);
+    } else {
+        TraceStage stage("match counting");
+        size_t numMatches = 0;
+        for (auto&& imageA : images) {
+            if (!counted(imageA.ImageId())) continue;
+            for (auto&& imageB : images) {
+                if (imageA.ImageId() >= imageB.ImageId()) continue;
+                if (!database.ExistsMatches(imageA.ImageId(),imageB.ImageId())) continue;
+                const colmap::FeatureMatches matches = database.ReadMatches(imageA.ImageId(),imageB.ImageId());
+                numMatches += matches.size();
+                for (auto&& match : matches) {
+                    const KeypointIndex keypointA = std::make_pair(imageA.ImageId(),match.point2D_idx1);
+                    increment(matchCounts, keypointA);
+                }
+                if (!database.ExistsInlierMatches(imageA.ImageId(),imageB.ImageId())) continue;
+                const colmap::TwoViewGeometry twoViewGeometry = database.ReadTwoViewGeometry(imageA.ImageId(),imageB.ImageId());
+                const colmap::FeatureMatches& inlierMatches = twoViewGeometry.inlier_matches;
+                numMatches += inlierMatches.size();
+                for (auto&& match : inlierMatches) {
+                    const KeypointIndex keypointA = std::make_pair(imageA.ImageId(),match.point2D_idx1);
+                    increment(inlierMatchCounts, keypointA);
+                }
             }
         }
+        stage.AddRows(numMatches);
     }
 
     auto descriptorToString = [](const colmap::FeatureDescriptor& descriptor) -> std::string {
@@ -105,13 +298,30 @@ int main(int argc, char *argv[]) {
         return ss.str();
     };
 
+    //
+    // The global N of each image's first row, so that a partitioned run
+    // numbers its rows as a full run would.
+    //
     size_t totalKeypoints = 0;
+    size_t partitionKeypoints = 0;
+    std::vector<size_t> imageOffsets;
     for (auto&& image : images) {
         const colmap::image_t imageId = image.ImageId();
         const size_t numKeypoints = database.NumKeypointsForImage(imageId);
+        imageOffsets.push_back(totalKeypoints);
         totalKeypoints += numKeypoints;
+        if (partition.Contains(imageId))
+            partitionKeypoints += numKeypoints;
     }
     std::cout << "total keypoints = " << totalKeypoints << "\n";
+    if (partition.Partitioned())
+        std::cout << "partition keypoints = " << partitionKeypoints << "\n";
+
+    struct ImageSummary {
+        colmap::image_t imageId;
+        size_t offset, keypoints, withMatches, withInlierMatches, with3DPoints;
+    };
+    std::vector<ImageSummary> imageSummaries;
 
     std::ofstream csv(featureLabelsCSV);
     if (!csv.is_open()) {
@@ -119,30 +329,88 @@ int main(int argc, char *argv[]) {
         exit(-1);
     }
 
+    //
+    // With -n the rows also go to NumPy arrays, row for row with the CSV:
+    // PREFIX-descriptors.npy uint8[N,128], PREFIX-frames.npy float32[N,6]
+    // (KX,KY,A11,A12,A21,A22) and PREFIX-labels.npy int32[N,3]
+    // (MATCHES,INLIERS,HASPT3D).
+    //
+    std::unique_ptr<NpyWriter> descriptorsNpy, framesNpy, labelsNpy;
+    if (!npyPrefix.empty()) {
+        descriptorsNpy.reset(new NpyWriter(npyPrefix + "-descriptors.npy", "<u1", 128));
+        framesNpy.reset(new NpyWriter(npyPrefix + "-frames.npy", "<f4", 6));
+        labelsNpy.reset(new NpyWriter(npyPrefix + "-labels.npy", "<i4", 3));
+        if (!descriptorsNpy->IsOpen() || !framesNpy->IsOpen() || !labelsNpy->IsOpen()) {
+            std::cerr << "Unable to open '" << npyPrefix << "-*.npy' for writing!\n";
+            exit(-1);
+        }
+    }
+    std::vector<float> frames;
+    std::vector<int32_t> labels;
+
+    TraceStage csvStage("CSV write");
     csv << "N,IMGNAME,IMGID,I,KX,KY,A11,A12,A21,A22,MATCHES,INLIERS,HASPT3D,DESC\n";
     
-    size_t n = 0;
+    size_t rows = 0;
     size_t featuresWithMatches = 0;
     size_t featuresWithInlierMatches = 0;
     size_t featuresWith3DPoints = 0;
-    for (auto&& image : images) {
-        const double progress = 100.0 * double(n)/totalKeypoints;
-        std::cout << "\r" << progress << "% keypoints output" << std::flush;
+    for (size_t imageIndex = 0; imageIndex < images.size(); imageIndex++) {
+        const colmap::Image& image = images[imageIndex];
         const colmap::image_t imageId = image.ImageId();
+        if (!partition.Contains(imageId)) continue;
+        const double progress = 100.0 * double(rows)/partitionKeypoints;
+        std::cout << "\r" << progress << "% keypoints output" << std::flush;
+        size_t n = imageOffsets[imageIndex];
+        ImageSummary summary = {imageId, n, 0, 0, 0, 0};
         const std::string name = image.Name();
-        const colmap::FeatureKeypoints keypoints = database.ReadKeypoints(imageId);
-        const colmap::FeatureDescriptors descriptors = database.ReadDescriptors(imageId);
-        const size_t numKeypoints = database.NumKeypointsForImage(imageId);
+        colmap::FeatureKeypoints keypoints;
+        colmap::FeatureDescriptors descriptors;
+        size_t numKeypoints;
+        {
+            TraceStage stage("keypoint read");
+            keypoints = database.ReadKeypoints(imageId);
+            descriptors = database.ReadDescriptors(imageId);
+            numKeypoints = database.NumKeypointsForImage(imageId);
+            stage.AddRows(numKeypoints);
+            stage.AddBytes(descriptors.size());
+        }
+        // the labels of a clean image come from the cache, by increasing keypoint index
+        const FeatureCache::Image* cached =
+            (incremental && dirtyImages.count(imageId) == 0) ? &cache.images.at(imageId) : nullptr;
+        size_t nextLabel = 0;
+        FeatureCache::Image* entry = incremental ? &newCache.images[imageId] : nullptr;
+        if (entry)
+            entry->numKeypoints = uint32_t(numKeypoints);
+        frames.clear();
+        labels.clear();
         for (colmap::point2D_t i = 0; size_t(i) < numKeypoints; i++) {
             const KeypointIndex k = std::make_pair(imageId,i);
             const colmap::FeatureKeypoint& kp = keypoints[i];
             const colmap::FeatureDescriptor& desc = descriptors.row(i);
-            const size_t matches = matchCounts[k];
-            const size_t inlierMatches = inlierMatchCounts[k];
-            const bool hasPoint3D = keypointsWith3DPoints.find(k) != keypointsWith3DPoints.end();
-            if (matches > 0) featuresWithMatches++;
-            if (inlierMatches > 0) featuresWithInlierMatches++;
-            if (hasPoint3D) featuresWith3DPoints++;
+            size_t matches, inlierMatches;
+            bool hasPoint3D;
+            if (cached) {
+                FeatureCache::Label label = {i, 0, 0, 0};
+                if (nextLabel < cached->labels.size() && cached->labels[nextLabel].index == i)
+                    label = cached->labels[nextLabel++];
+                matches = label.matches;
+                inlierMatches = label.inlierMatches;
+                hasPoint3D = label.hasPoint3D != 0;
+            } else {
+                matches = matchCounts[k];
+                inlierMatches = inlierMatchCounts[k];
+                hasPoint3D = keypointsWith3DPoints.find(k) != keypointsWith3DPoints.end();
+            }
+            if (entry && (matches > 0 || inlierMatches > 0 || hasPoint3D))
+                entry->labels.push_back({i, uint32_t(matches), uint32_t(inlierMatches), uint32_t(hasPoint3D)});
+            if (labelsNpy) {
+                frames.insert(frames.end(), {kp.x, kp.y, kp.a11, kp.a12, kp.a21, kp.a22});
+                labels.insert(labels.end(), {int32_t(matches), int32_t(inlierMatches), int32_t(hasPoint3D)});
+            }
+            if (matches > 0) summary.withMatches++;
+            if (inlierMatches > 0) summary.withInlierMatches++;
+            if (hasPoint3D) summary.with3DPoints++;
             csv << n << "," << name << "," << imageId << "," << i << ","
                 << std::fixed << std::setprecision(2)
                 << kp.x << "," << kp.y << ","
@@ -154,11 +422,52 @@ int main(int argc, char *argv[]) {
                 << descriptorToString(desc) << "\n";
             n++;
         }
+        if (descriptorsNpy) {
+            // the descriptors of an image are already a row-major uint8 [numKeypoints,128] block
+            TraceStage stage("npy write");
+            descriptorsNpy->Append(descriptors.data(), numKeypoints);
+            framesNpy->Append(frames.data(), numKeypoints);
+            labelsNpy->Append(labels.data(), numKeypoints);
+            stage.AddRows(numKeypoints);
+        }
+        summary.keypoints = numKeypoints;
+        featuresWithMatches += summary.withMatches;
+        featuresWithInlierMatches += summary.withInlierMatches;
+        featuresWith3DPoints += summary.with3DPoints;
+        imageSummaries.push_back(summary);
+        rows += numKeypoints;
+        traceCounter("rows", numKeypoints);
     }
 
+    csvStage.AddRows(rows);
+    csvStage.AddBytes(size_t(csv.tellp()));
     csv.close();
 
-    std::cout << "total features ..............." << totalKeypoints << "\n"
+    if (descriptorsNpy && !(descriptorsNpy->Close() && framesNpy->Close() && labelsNpy->Close())) {
+        std::cerr << "Unable to write '" << npyPrefix << "-*.npy'!\n";
+        exit(-1);
+    }
+
+    if (incremental && !newCache.Write(cachePath)) {
+        std::cerr << "Unable to write cache '" << cachePath << "'!\n";
+        exit(-1);
+    }
+
+    if (partition.Partitioned()) {
+        const std::string imagesCSV = featureLabelsCSV + ".images";
+        std::ofstream os(imagesCSV);
+        if (!os.is_open()) {
+            std::cerr << "Unable to open '" << imagesCSV << "' for writing!\n";
+            exit(-1);
+        }
+        os << "IMGID,N,KEYPOINTS,MATCHED,INLIERS,HASPT3D,TOTAL\n";
+        for (auto&& summary : imageSummaries)
+            os << summary.imageId << "," << summary.offset << "," << summary.keypoints << ","
+               << summary.withMatches << "," << summary.withInlierMatches << "," << summary.with3DPoints << ","
+               << totalKeypoints << "\n";
+    }
+
+    std::cout << "total features ..............." << rows << "\n"
               << "features w matches............" << featuresWithMatches << "\n"
               << "features w inliear matches...." << featuresWithInlierMatches << "\n"
               << "features w 3D Points.........." << featuresWith3DPoints << "\n";
@@ -1,16 +1,25 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <iomanip>
 #include <cmath>
 #include <cassert>
 #include <string>
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <thread>
+#include <functional>
+#include <unistd.h>
 #include <opencv2/opencv.hpp>
 #include <opencv2/imgproc.hpp>
 #include <Eigen/Dense>
 #include <nlohmann/json.hpp>
 #include "rectpack2D/finders_interface.h"
+#include "rectpack2D/shelf_packer.h"
+#include "prefetcher.h"
+#include "region-decoder.h"
+#include "instrumentation.h"
 
 std::vector<std::string> split(const std::string& str, char delim) {
     std::vector<std::string> strings;
@@ -50,6 +59,7 @@ struct Feature {
 };
 
 std::vector<Feature> readFeatures(std::string path) {
+    TraceStage stage("parse");
     std::vector<Feature> features;
     std::ifstream is(path);
     if (!is.is_open()) {
@@ -58,6 +68,7 @@ std::vector<Feature> readFeatures(std::string path) {
     }
     std::string line;
     while (std::getline(is, line)) {
+        stage.AddBytes(line.size() + 1);
         if (line.length() <= 0 || line.at(0) == '#') continue;
         const std::vector<std::string> str = split(line, ',');
         if (str.size() != 14) break;
@@ -81,71 +92,284 @@ std::vector<Feature> readFeatures(std::string path) {
         }
         features.emplace_back(std::move(feature));
     }
+    stage.AddRows(features.size());
     return features;
 }
 
+//
+// Warps the affine frame of each of the given features (the points
+// keypoint + A*p for p in [-radius,radius]^2) to a canonical S x S
+// grayscale patch. The patches are written as one contiguous,
+// memory-mappable uint8[N][S][S] tensor (output-base-patches.u8), their
+// labels as int32[N][4] rows of N,MATCHES,INLIERS,HASPT3D
+// (output-base-labels.i32) and the shapes to output-base-tensor.json.
+// Source images are decoded once each (at reduced scale when the
+// frames are large) and the warps are batched across threads.
+//
+void writePatchTensor(const std::vector<Feature>& features,
+                      const std::vector<size_t>& indices,
+                      const std::string& imageFolder,
+                      const int S,
+                      const double radius,
+                      const std::string& outputBase,
+                      size_t decoderThreads,
+                      size_t maxInFlight) {
+    //
+    // Group features by source image.
+    //
+    std::vector<std::string> imageNames;
+    std::vector<std::vector<size_t>> imageFeatures;
+    {
+        std::map<std::string,size_t> imageIndex;
+        for (size_t i : indices) {
+            const std::string& imageName = features[i].imageName;
+            auto iter = imageIndex.find(imageName);
+            if (iter == imageIndex.end()) {
+                iter = imageIndex.insert({imageName, imageNames.size()}).first;
+                imageNames.push_back(imageName);
+                imageFeatures.emplace_back();
+            }
+            imageFeatures[iter->second].push_back(i);
+        }
+    }
+
+    //
+    // Bounding box of the (full resolution) frame of a feature.
+    //
+    auto frameRect = [&](const Feature& f) -> cv::Rect {
+        const float ex = radius * (std::abs(f.A(0,0)) + std::abs(f.A(0,1)));
+        const float ey = radius * (std::abs(f.A(1,0)) + std::abs(f.A(1,1)));
+        const int x0 = int(std::floor(f.keypoint(0) - ex)) - 1;
+        const int y0 = int(std::floor(f.keypoint(1) - ey)) - 1;
+        const int x1 = int(std::ceil(f.keypoint(0) + ex)) + 1;
+        const int y1 = int(std::ceil(f.keypoint(1) + ey)) + 1;
+        return cv::Rect(x0, y0, x1 - x0, y1 - y0);
+    };
+
+    Prefetcher<DecodedImage> decoder(imageNames.size(),
+                                     [&](size_t i) -> DecodedImage {
+                                         std::vector<cv::Rect> regions;
+                                         for (size_t k : imageFeatures[i])
+                                             regions.push_back(frameRect(features[k]));
+                                         const std::vector<cv::Size> sizes(regions.size(), cv::Size(S, S));
+                                         const std::string imagePath = imageFolder + "/" + imageNames[i];
+                                         TraceStage stage("decode");
+                                         DecodedImage decoded = decodeImageRegions(imagePath, regions,
+                                                                                   reducedDecodeScale(regions, sizes),
+                                                                                   true);
+                                         stage.AddRows(regions.size());
+                                         stage.AddBytes(decoded.image.rows * decoded.image.step);
+                                         return decoded;
+                                     },
+                                     decoderThreads,
+                                     maxInFlight);
+
+    const std::string patchesPath = outputBase + "-patches.u8";
+    const std::string labelsPath = outputBase + "-labels.i32";
+    std::ofstream patchesFile(patchesPath, std::ios::binary);
+    std::ofstream labelsFile(labelsPath, std::ios::binary);
+    if (!patchesFile.is_open() || !labelsFile.is_open()) {
+        std::cerr << "Unable to open '" << patchesPath << "' or '" << labelsPath << "' for writing!\n";
+        exit(-1);
+    }
+
+    //
+    // Warps are queued (with a reference to their decoded image) and
+    // run in parallel once enough of them have accumulated, or once the
+    // queued images reach maxInFlight: with sparse features the batch
+    // would otherwise hold thousands of full decoded images.
+    //
+    constexpr size_t batchSize = 4096;
+    struct Warp {
+        size_t feature;
+        size_t image;   // index into batchImages
+    };
+    std::vector<Warp> batch;
+    std::vector<DecodedImage> batchImages;
+    std::vector<uint8_t> patches;
+    std::vector<int32_t> labels;
+    size_t N = 0;
+
+    auto flush = [&]() {
+        TraceStage stage("warp");
+        const size_t n = batch.size();
+        patches.assign(n*S*S, 0);
+        labels.resize(n*4);
+        cv::parallel_for_(cv::Range(0, int(n)), [&](const cv::Range& range) {
+            for (int b = range.start; b < range.end; b++) {
+                const Feature& f = features[batch[b].feature];
+                const DecodedImage& decoded = batchImages[batch[b].image];
+                //
+                // Map canonical pixel (j,i) to p = d*(j,i) + o in the frame,
+                // then into the decoded image. COLMAP puts the center of
+                // the top left pixel at (0.5,0.5), OpenCV at (0,0).
+                //
+                const double d = 2*radius/S;
+                const double o = radius/S - radius;
+                const Eigen::Matrix2d A = f.A.cast<double>() / decoded.scale;
+                const Eigen::Vector2d t = f.keypoint.cast<double>() / decoded.scale
+                    - Eigen::Vector2d(0.5, 0.5) + A * Eigen::Vector2d(o, o);
+                const cv::Matx23d M(d*A(0,0), d*A(0,1), t(0),
+                                    d*A(1,0), d*A(1,1), t(1));
+                cv::Mat dst(S, S, CV_8UC1, patches.data() + size_t(b)*S*S);
+                cv::warpAffine(decoded.image, dst, M, cv::Size(S, S),
+                               cv::INTER_LINEAR | cv::WARP_INVERSE_MAP,
+                               cv::BORDER_CONSTANT, cv::Scalar(0));
+                labels[4*b + 0] = f.num;
+                labels[4*b + 1] = f.matches;
+                labels[4*b + 2] = f.inlierMatches;
+                labels[4*b + 3] = f.hasPoint3D ? 1 : 0;
+            }
+        });
+        patchesFile.write(reinterpret_cast<const char*>(patches.data()), patches.size());
+        labelsFile.write(reinterpret_cast<const char*>(labels.data()), labels.size()*sizeof(int32_t));
+        stage.AddRows(n);
+        stage.AddBytes(patches.size() + labels.size()*sizeof(int32_t));
+        traceCounter("patches", n);
+        N += n;
+        batch.clear();
+        batchImages.clear();
+    };
+
+    for (size_t i = 0; i < imageNames.size(); i++) {
+        DecodedImage decoded = decoder.Next();
+        if (decoded.image.empty()) {
+            std::cerr << "warning: unable to read '" << imageNames[i] << "'\n";
+            continue;
+        }
+        batchImages.emplace_back(std::move(decoded));
+        for (size_t k : imageFeatures[i])
+            batch.push_back({k, batchImages.size() - 1});
+        if (batch.size() >= batchSize || batchImages.size() >= maxInFlight)
+            flush();
+    }
+    flush();
+
+    nlohmann::json tensor;
+    tensor["patches"]["file"] = patchesPath;
+    tensor["patches"]["dtype"] = "uint8";
+    tensor["patches"]["shape"] = {N, size_t(S), size_t(S)};
+    tensor["labels"]["file"] = labelsPath;
+    tensor["labels"]["dtype"] = "int32";
+    tensor["labels"]["shape"] = {N, size_t(4)};
+    tensor["labels"]["columns"] = {"N", "MATCHES", "INLIERS", "HASPT3D"};
+    tensor["radius"] = radius;
+    const std::string tensorPath = outputBase + "-tensor.json";
+    std::ofstream json(tensorPath);
+    if (!json.is_open()) {
+        std::cerr << "Unable to open '" << tensorPath << "' for writing!\n";
+        exit(-1);
+    }
+    json << tensor.dump(2) << "\n";
+
+    std::cout << N << " patches written to '" << patchesPath << "'\n";
+}
+
 int main(int argc, char *argv[]) {
 
-    if (argc != 5) {
-        std::cerr << "usage: " << argv[0] << " features.csv soure-images max-patches output-base\n";
+    //
+    // Label predicates that split the features into two atlases each:
+    // those features satisfying the predicate (output-base-NAME.png)
+    // and those that do not (output-base-no-NAME.png).
+    //
+    struct Label {
+        std::string name;
+        std::function<bool(const Feature&)> predicate;
+    };
+    const std::vector<Label> knownLabels = {
+        {"matches", [](const Feature& f) { return f.matches > 0; }},
+        {"inliers", [](const Feature& f) { return f.inlierMatches > 0; }},
+        {"has3D",   [](const Feature& f) { return f.hasPoint3D; }},
+    };
+
+    //
+    // Decoding source images dominates the runtime, so it is done
+    // by a pool of decoder threads that run ahead of the packing.
+    //
+    size_t decoderThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t maxInFlight = 0; // images decoded but not yet copied (0 => 2*decoderThreads)
+    std::string labelNames = "has3D";
+    int maxPatchSide = 0;   // larger patches are downscaled to fit (0 => never)
+    int tensorSize = 0;     // export canonical S x S patch tensor instead of atlases
+    std::string packer = "spaces";  // "spaces" (empty spaces packer) or "shelf"
+
+    auto usage = [&]() {
+        std::cerr << "usage: " << argv[0] << " [-j decoder-threads] [-k max-images-in-flight] "
+                  << "[-l matches,inliers,has3D] [-s max-patch-side] [-T tensor-patch-size] [-P spaces|shelf] [-t trace.json] "
+                  << "features.csv soure-images max-patches output-base\n";
         exit(-1);
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:k:l:s:T:P:t:")) != -1) {
+        switch (opt) {
+        case 'j': decoderThreads = std::max(1, std::atoi(optarg)); break;
+        case 'k': maxInFlight = std::max(1, std::atoi(optarg)); break;
+        case 'l': labelNames = optarg; break;
+        case 's': maxPatchSide = std::max(2, std::atoi(optarg)); break;
+        case 'T': tensorSize = std::max(2, std::atoi(optarg)); break;
+        case 'P': packer = optarg; break;
+        case 't': enableTrace(optarg); break;
+        default: usage();
+        }
     }
+    if (maxInFlight == 0)
+        maxInFlight = 2*decoderThreads;
 
-    const std::string featuresCSV(argv[1]);
-    const std::string imageFolder(argv[2]);
-    const size_t maxPatches = std::atoi(argv[3]);
+    if (argc - optind != 4 || (packer != "spaces" && packer != "shelf"))
+        usage();
+
+    const std::string featuresCSV(argv[optind]);
+    const std::string imageFolder(argv[optind+1]);
+    const size_t maxPatches = std::atoi(argv[optind+2]);
     assert(maxPatches > 10);
-    const std::string outputBase(argv[4]);
+    const std::string outputBase(argv[optind+3]);
+
+    std::vector<Label> labels;
+    for (auto&& name : split(labelNames, ',')) {
+        auto iter = std::find_if(knownLabels.begin(), knownLabels.end(),
+                                 [&](const Label& label) { return label.name == trim(name); });
+        if (iter == knownLabels.end()) {
+            std::cerr << "Unknown label '" << name << "'\n";
+            usage();
+        }
+        labels.push_back(*iter);
+    }
 
     //
     // Read in feature information.
     //
     std::vector<Feature> features = readFeatures(featuresCSV);
-    const size_t N = features.size();
 
     //
-    // Partition features into those features that have matches
-    // and those that do not. We assume the features are arranged such
-    // that features that from the same image are grouped together;
-    // We use a stable partition to preserve this arrangement.
-    //
-    std::vector<size_t> featuresWithMatchesIndices;
-    std::vector<size_t> featuresWithoutMatchesIndices;
-    for (size_t i = 0; i < features.size(); i++)
-        // XXX if (features[i].matches > 0)
-        // XXX if (features[i].inlierMatches > 0)
-        if (features[i].hasPoint3D)
-            featuresWithMatchesIndices.push_back(i);
-        else
-            featuresWithoutMatchesIndices.push_back(i);
-
+    // Extent of a feature patch relative to the feature's scale.
     //
-    // Pick a evenly distributed subset of the features with
-    // matches for output patches with matches.
-    //
-    const size_t M = featuresWithMatchesIndices.size();
-    std::vector<size_t> patchesWithMatchesIndices;
-    const size_t m = std::min(maxPatches, M);
-    const size_t mdi = (M + m - 1)/m;
-    for (size_t k = 0; k < M; k += mdi)
-        patchesWithMatchesIndices.push_back(featuresWithMatchesIndices[k]);
+    constexpr double bboxScale = 1.5;
 
     //
-    // Similarly for patche without matches.
+    // Tensor export mode: an evenly distributed subset of all features
+    // (labels are recorded per patch rather than split into atlases).
     //
-    const size_t Q = featuresWithoutMatchesIndices.size();
-    std::vector<size_t> patchesWithoutMatchesIndices;
-    const size_t q = std::min(maxPatches,Q);
-    const size_t qdi = (Q + q - 1)/q;
-    for (size_t k = 0; k < Q; k += qdi)
-        patchesWithoutMatchesIndices.push_back(featuresWithoutMatchesIndices[k]);
+    if (tensorSize > 0) {
+        std::vector<size_t> indices;
+        const size_t M = features.size();
+        const size_t m = std::min(maxPatches, M);
+        const size_t mdi = m > 0 ? (M + m - 1)/m : 1;
+        for (size_t k = 0; k < M; k += mdi)
+            indices.push_back(k);
+        writePatchTensor(features, indices, imageFolder, tensorSize, bboxScale,
+                         outputBase, decoderThreads, maxInFlight);
+        return 0;
+    }
 
     //
-    // Source image patch information that surrounds feature.
+    // Source image patch information that surrounds feature
+    // and the size of the patch in the output atlas.
     //
     struct Patch {
         std::string imageName;
         cv::Rect rect;
+        cv::Size size;
     };
 
     //
@@ -153,7 +377,11 @@ int main(int argc, char *argv[]) {
     //
     constexpr bool allow_flip = false;
     const auto runtime_flipping_mode = rectpack2D::flipping_option::DISABLED;
-    using spaces_type = rectpack2D::empty_spaces<allow_flip, rectpack2D::default_empty_spaces>;
+#if defined(__AVX2__)
+    using spaces_type = rectpack2D::empty_spaces<allow_flip, rectpack2D::soa_empty_spaces>;
+#else
+    using spaces_type = rectpack2D::empty_spaces<allow_flip, rectpack2D::indexed_empty_spaces>;
+#endif
     using rect_type = rectpack2D::output_rect_t<spaces_type>;
 
     const size_t padding = 4;
@@ -163,7 +391,6 @@ int main(int argc, char *argv[]) {
     //
     // How to find a feature patch for a given features;
     //
-    constexpr double bboxScale = 1.5;
     auto featureToPatch = [&](const Feature& f, Patch& patch) -> bool {
         const double scaleX = f.A.col(0).norm() * bboxScale;
         const double scaleY = f.A.col(1).norm() * bboxScale;
@@ -183,151 +410,222 @@ int main(int argc, char *argv[]) {
         const int y0 = int(std::floor(bboxTop));
         const int W = int(std::ceil(bboxRight)) - x0;
         const int H = int(std::ceil(bboxBottom)) - y0;
-        if (W < 2 || H < 2 || W + padding > max_side || H + padding > max_side || x0 < 0 || y0 < 0)
+        cv::Size size(W, H);
+        if (maxPatchSide > 0 && std::max(W, H) > maxPatchSide) {
+            const double scale = double(maxPatchSide) / std::max(W, H);
+            size = cv::Size(std::max(2, int(std::lround(W*scale))), std::max(2, int(std::lround(H*scale))));
+        }
+        if (W < 2 || H < 2 || size.width + padding > max_side || size.height + padding > max_side || x0 < 0 || y0 < 0)
             return false;
         patch.imageName = f.imageName;
         patch.rect = cv::Rect(x0, y0, W, H);
+        patch.size = size;
         return true;;
     };
 
     //
-    // Create source patch information for patches with matches.
+    // Each label yields two atlases (features with and without the label).
+    // An atlas is split into as many max_side x max_side pages as needed
+    // to hold all of its patches (written as base-000.png, base-001.png, ...).
     //
-    std::vector<Patch> patchesWithMatches;
-    for (size_t i : patchesWithMatchesIndices) {
-        const Feature& f = features[i];
-        Patch patch;
-        if (featureToPatch(f, patch))
-            patchesWithMatches.emplace_back(patch);
-    }
-    
+    struct Atlas {
+        std::string base;
+        std::vector<Patch> patches;
+        std::vector<rect_type> rectangles;   // rectangles[i] is where patches[i] goes
+        std::vector<int> page;               // page of patches[i] (-1 if it did not fit)
+        std::vector<rectpack2D::rect_wh> pageSizes;
+        std::vector<cv::Mat> images;         // one per page
+    };
+
+    //
+    // Pick a evenly distributed subset of at most maxPatches features
+    // from the given (ordered) feature indices and create their source
+    // patch information.
     //
-    // Create source patch information for patches without matches.
+    auto selectPatches = [&](const std::vector<size_t>& indices) -> std::vector<Patch> {
+        std::vector<Patch> patches;
+        const size_t M = indices.size();
+        if (M == 0) return patches;
+        const size_t m = std::min(maxPatches, M);
+        const size_t mdi = (M + m - 1)/m;
+        for (size_t k = 0; k < M; k += mdi) {
+            Patch patch;
+            if (featureToPatch(features[indices[k]], patch))
+                patches.emplace_back(patch);
+        }
+        return patches;
+    };
+
     //
-    std::vector<Patch> patchesWithoutMatches;
-    for (size_t i : patchesWithoutMatchesIndices) {
-        const Feature& f = features[i];
-        Patch patch;
-        if (featureToPatch(f, patch))
-            patchesWithoutMatches.emplace_back(patch);
+    // Partition features into those features that satisfy each label
+    // and those that do not. We assume the features are arranged such
+    // that features that from the same image are grouped together;
+    // We use a stable partition to preserve this arrangement.
+    //
+    std::vector<Atlas> atlases;
+    for (auto&& label : labels) {
+        std::vector<size_t> featuresWithLabelIndices;
+        std::vector<size_t> featuresWithoutLabelIndices;
+        for (size_t i = 0; i < features.size(); i++)
+            if (label.predicate(features[i]))
+                featuresWithLabelIndices.push_back(i);
+            else
+                featuresWithoutLabelIndices.push_back(i);
+
+        Atlas with, without;
+        with.base = outputBase + "-" + label.name;
+        with.patches = selectPatches(featuresWithLabelIndices);
+        without.base = outputBase + "-no-" + label.name;
+        without.patches = selectPatches(featuresWithoutLabelIndices);
+        atlases.emplace_back(std::move(with));
+        atlases.emplace_back(std::move(without));
     }
 
     //
     // Function that maps source image patches to output / packed rectangles.
     //
+    // find_packing_pages() does not reorder the rectangles, it writes
+    // each result in place, so rectangles[i] stays the slot of patches[i]
+    // and page[i] is the page it landed on. The shelf packer does the same
+    // in a single pass; it is much faster on near-uniform patch sizes at
+    // the cost of some density.
+    //
     auto packRectangles = [&](const std::vector<Patch>& patches,
-                              std::vector<rect_type>& rectangles) -> rectpack2D::rect_wh {
+                              std::vector<rect_type>& rectangles,
+                              std::vector<int>& page) -> std::vector<rectpack2D::rect_wh> {
+        TraceStage stage("pack");
+        stage.AddRows(patches.size());
         for (auto&& patch : patches) {
-            rectpack2D::rect_xywh packedRect(0,0, patch.rect.width+padding, patch.rect.height+padding);
+            rectpack2D::rect_xywh packedRect(0,0, patch.size.width+padding, patch.size.height+padding);
             rectangles.emplace_back(packedRect);
         }
         // XXX bool packing_success = true;
         size_t failCount = 0;
-        const auto result_size = rectpack2D::find_best_packing<spaces_type>(
-            rectangles,
-            rectpack2D::make_finder_input(
-                max_side,
-                discard_step,
-                [](rect_type& r) {
-                    return rectpack2D::callback_result::CONTINUE_PACKING;
-                },
-                [&](rect_type& r) {
-                    // XXX packing_success = false;
-                    // XXX return rectpack2D::callback_result::ABORT_PACKING;
-                    failCount++;
-                    return rectpack2D::callback_result::CONTINUE_PACKING;
-                },
-                runtime_flipping_mode
-                )
+        const auto finder_input = rectpack2D::make_finder_input(
+            max_side,
+            discard_step,
+            [](rect_type& r) {
+                return rectpack2D::callback_result::CONTINUE_PACKING;
+            },
+            [&](rect_type& r) {
+                // XXX packing_success = false;
+                // XXX return rectpack2D::callback_result::ABORT_PACKING;
+                failCount++;
+                return rectpack2D::callback_result::CONTINUE_PACKING;
+            },
+            runtime_flipping_mode
             );
+        const auto result_sizes = packer == "shelf" ?
+            rectpack2D::find_shelf_packing_pages<spaces_type>(rectangles, page, finder_input) :
+            rectpack2D::find_packing_pages<spaces_type>(rectangles, page, finder_input);
         if (failCount > 0) {
             std::cerr << "warning: " << failCount << " failures!\n";
         }
-        return result_size;
+        return result_sizes;
     };
 
-    
-    //
-    // Find the output packing rectangles for feature patches with matches.
-    //
-    std::vector<rect_type> packedRectanglesWithMatches;
-    const rectpack2D::rect_wh matchesSize = packRectangles(patchesWithMatches, packedRectanglesWithMatches);
-    
     //
-    // Find the output packing rectangles for feature patches without matches.
+    // Find the output packing rectangles for each atlas.
     //
-    std::vector<rect_type> packedRectanglesWithoutMatches;
-    const rectpack2D::rect_wh noMatchesSize = packRectangles(patchesWithoutMatches, packedRectanglesWithoutMatches);
+    for (auto&& atlas : atlases) {
+        atlas.pageSizes = packRectangles(atlas.patches, atlas.rectangles, atlas.page);
+        std::cout << atlas.base << ": " << atlas.patches.size() << " patches, "
+                  << atlas.pageSizes.size() << " pages, packing density "
+                  << rectpack2D::packing_density(atlas.rectangles, atlas.page, atlas.pageSizes) << "\n";
+        for (auto&& size : atlas.pageSizes)
+            atlas.images.emplace_back(size.h, size.w, CV_8UC3, cv::Scalar(0, 0, 0));
+    }
 
     //
-    // find_best_packing() in the packRectangles function above
-    // rearranged the rectangles array so we create a
-    // multi-map to find the appropriately sized
-    // rectangle in the permuted rectangles array.
+    // Group the patches of every atlas by source image so that
+    // each source image is decoded exactly once.
     //
-    std::multimap<std::pair<int,int>,size_t> packedRectWithMatchesToIndex;  // maps w,h to index
-    for (size_t i = 0; i < packedRectanglesWithMatches.size(); i++) {
-        const auto& rect = packedRectanglesWithMatches[i];
-        packedRectWithMatchesToIndex.insert({std::make_pair(rect.w,rect.h),i});
-    }
-    
-    std::multimap<std::pair<int,int>,size_t> packedRectWithoutMatchesToIndex;  // maps w,h to index
-    for (size_t i = 0; i < packedRectanglesWithoutMatches.size(); i++) {
-        const auto& rect = packedRectanglesWithoutMatches[i];
-        packedRectWithoutMatchesToIndex.insert({std::make_pair(rect.w,rect.h),i});
+    std::vector<std::string> imageNames;
+    std::vector<std::vector<std::pair<size_t,size_t>>> imagePatches;  // (atlas, patch) per image
+    {
+        std::map<std::string,size_t> imageIndex;
+        for (size_t a = 0; a < atlases.size(); a++) {
+            for (size_t p = 0; p < atlases[a].patches.size(); p++) {
+                const std::string& imageName = atlases[a].patches[p].imageName;
+                auto iter = imageIndex.find(imageName);
+                if (iter == imageIndex.end()) {
+                    iter = imageIndex.insert({imageName, imageNames.size()}).first;
+                    imageNames.push_back(imageName);
+                    imagePatches.emplace_back();
+                }
+                imagePatches[iter->second].emplace_back(a, p);
+            }
+        }
     }
 
     //
-    // Function for creating a image containing the packed images.
+    // The source images are decoded ahead of time by the prefetcher
+    // while this thread copies each image's patches into their atlases.
+    // Only the MCU rows covering an image's patches are decoded, at the
+    // smallest JPEG DCT scale at which no patch has to be upsampled.
     //
-    cv::Mat currentImage;
-    std::string currentImageName;
-    cv::Rect currentImageRect;
-    
-    auto packedPatchesImage = [&](const std::vector<Patch>& patches,
-                                  const std::vector<rect_type>& packedRectangles,
-                                  std::multimap<std::pair<int,int>,size_t>& sizeToRectIndexMap,
-                                  const rectpack2D::rect_wh& packedImageSize) -> cv::Mat {
-        cv::Mat packedPatches(packedImageSize.h, packedImageSize.w, CV_8UC3, cv::Scalar(0, 0, 0));
-        for (auto&& patch : patches) {
-            if (patch.imageName != currentImageName) {
-                const std::string imagePath = imageFolder + "/" + patch.imageName;
-                currentImage = cv::imread(imagePath, cv::IMREAD_COLOR);
-                currentImageName = patch.imageName;
-                currentImageRect = cv::Rect(0,0, currentImage.cols, currentImage.rows);
-            }
-            const bool is_inside = (patch.rect & currentImageRect) == patch.rect;
-            if (!is_inside) continue;
-            cv::Mat sourcePatch = currentImage(patch.rect);
-            const auto wh = std::make_pair(patch.rect.width + padding, patch.rect.height + padding);
-            auto iter = sizeToRectIndexMap.find(wh);
-            assert(iter != sizeToRectIndexMap.end());
-            const size_t index = iter->second;
-            const auto rect = packedRectangles[index];
+    Prefetcher<DecodedImage> decoder(imageNames.size(),
+                                     [&](size_t i) -> DecodedImage {
+                                         std::vector<cv::Rect> regions;
+                                         std::vector<cv::Size> sizes;
+                                         for (auto&& ap : imagePatches[i]) {
+                                             const Patch& patch = atlases[ap.first].patches[ap.second];
+                                             regions.push_back(patch.rect);
+                                             sizes.push_back(patch.size);
+                                         }
+                                         const std::string imagePath = imageFolder + "/" + imageNames[i];
+                                         TraceStage stage("decode");
+                                         DecodedImage decoded = decodeImageRegions(imagePath, regions,
+                                                                                   reducedDecodeScale(regions, sizes));
+                                         stage.AddRows(regions.size());
+                                         stage.AddBytes(decoded.image.rows * decoded.image.step);
+                                         return decoded;
+                                     },
+                                     decoderThreads,
+                                     maxInFlight);
+
+    for (size_t i = 0; i < imageNames.size(); i++) {
+        const DecodedImage decoded = decoder.Next();
+        TraceStage stage("copy");
+        stage.AddRows(imagePatches[i].size());
+        traceCounter("images", 1);
+        const int scale = decoded.scale;
+        const cv::Rect imageRect(0,0, decoded.size.width, decoded.size.height);
+        const cv::Rect scaledImageRect(0,0, decoded.image.cols, decoded.image.rows);
+        for (auto&& ap : imagePatches[i]) {
+            Atlas& atlas = atlases[ap.first];
+            const Patch& patch = atlas.patches[ap.second];
+            const bool is_inside = (patch.rect & imageRect) == patch.rect;
+            const int page = atlas.page[ap.second];
+            if (!is_inside || page < 0) continue;
+            const int x0 = patch.rect.x / scale;
+            const int y0 = patch.rect.y / scale;
+            const int x1 = (patch.rect.x + patch.rect.width + scale - 1) / scale;
+            const int y1 = (patch.rect.y + patch.rect.height + scale - 1) / scale;
+            const cv::Rect scaledRect = cv::Rect(x0, y0, x1 - x0, y1 - y0) & scaledImageRect;
+            cv::Mat sourcePatch = decoded.image(scaledRect);
+            const auto rect = atlas.rectangles[ap.second];
             cv::Rect roi(rect.x,rect.y,rect.w - padding,rect.h - padding);
-            sourcePatch.copyTo(packedPatches(roi));
-            sizeToRectIndexMap.erase(iter);
+            if (sourcePatch.size() == roi.size())
+                sourcePatch.copyTo(atlas.images[page](roi));
+            else {
+                cv::Mat dst = atlas.images[page](roi);
+                cv::resize(sourcePatch, dst, roi.size(), 0, 0, cv::INTER_AREA);
+            }
         }
-        return packedPatches;
-    };
+    }
 
-    cv::Mat packedPatchesImageWithMatches = packedPatchesImage(patchesWithMatches,
-                                                               packedRectanglesWithMatches,
-                                                               packedRectWithMatchesToIndex,
-                                                               matchesSize);
-    // XXX const std::string outputMatchesPath(outputBase + "-matches.png");
-    // XXX const std::string outputMatchesPath(outputBase + "-inliers.png");
-    const std::string outputMatchesPath(outputBase + "-has3D.png");
-    cv::imwrite(outputMatchesPath, packedPatchesImageWithMatches);
-    
-    
-    cv::Mat packedPatchesImageWithoutMatches = packedPatchesImage(patchesWithoutMatches,
-                                                               packedRectanglesWithoutMatches,
-                                                               packedRectWithoutMatchesToIndex,
-                                                               noMatchesSize);
-    // XXX const std::string outputNoMatchesPath(outputBase + "-no-matches.png");
-    const std::string outputNoMatchesPath(outputBase + "-no-has3D.png");
-    cv::imwrite(outputNoMatchesPath, packedPatchesImageWithoutMatches);
+    for (auto&& atlas : atlases) {
+        if (atlas.images.empty())
+            std::cerr << "warning: no patches for '" << atlas.base << "'\n";
+        for (size_t p = 0; p < atlas.images.size(); p++) {
+            std::ostringstream path;
+            path << atlas.base << "-" << std::setw(3) << std::setfill('0') << p << ".png";
+            TraceStage stage("encode");
+            stage.AddBytes(atlas.images[p].rows * atlas.images[p].step);
+            cv::imwrite(path.str(), atlas.images[p]);
+        }
+    }
 
     return 0;
 }
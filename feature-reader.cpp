@@ -0,0 +1,90 @@
+#include "feature-reader.h"
+#include <cstdlib>
+#include <cstring>
+
+FeatureReader::FeatureReader(const std::string& path) : is(path) {
+}
+
+size_t FeatureReader::ReadBlock(FeatureBlock& block, size_t maxRows) {
+	block.text.clear();
+	block.lineStarts.clear();
+	block.lineStarts.push_back(0);
+	while (block.Size() < maxRows && std::getline(is, line)) {
+		bytesRead += line.size() + 1;
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (line.empty() || line[0] == '#' || line.compare(0, 2, "N,") == 0)
+			continue;
+		block.text.append(line);
+		block.text.push_back('\n');
+		block.lineStarts.push_back(block.text.size());
+	}
+	return block.Size();
+}
+
+namespace {
+
+//
+// Field parsers advance p past the field and its trailing ','.
+// They rely on the line being followed by a '\n' (the block's text
+// always is), which stops strtol/strtof.
+//
+
+bool nextField(const char*& p, const char* end, const char*& fieldBegin, const char*& fieldEnd) {
+	if (p > end) return false;
+	fieldBegin = p;
+	const void* comma = std::memchr(p, ',', end - p);
+	fieldEnd = comma != nullptr ? static_cast<const char*>(comma) : end;
+	p = fieldEnd + 1;
+	return true;
+}
+
+template <class T>
+bool parseInteger(const char*& p, const char* end, T& value) {
+	const char *b, *e;
+	if (!nextField(p, end, b, e)) return false;
+	char* stop;
+	value = T(std::strtoll(b, &stop, 10));
+	return stop != b;
+}
+
+bool parseFloat(const char*& p, const char* end, float& value) {
+	const char *b, *e;
+	if (!nextField(p, end, b, e)) return false;
+	char* stop;
+	value = std::strtof(b, &stop);
+	return stop != b;
+}
+
+int hexValue(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+} // namespace
+
+bool parseFeatureRow(const char* begin, const char* end, FeatureRow& row) {
+	const char* p = begin;
+	const char *b, *e;
+	if (!parseInteger(p, end, row.num)) return false;
+	if (!nextField(p, end, b, e)) return false;
+	row.imageName = std::string_view(b, e - b);
+	if (!parseInteger(p, end, row.imageId) || !parseInteger(p, end, row.index)) return false;
+	if (!parseFloat(p, end, row.kx) || !parseFloat(p, end, row.ky)) return false;
+	if (!parseFloat(p, end, row.a11) || !parseFloat(p, end, row.a12) ||
+		!parseFloat(p, end, row.a21) || !parseFloat(p, end, row.a22)) return false;
+	if (!parseInteger(p, end, row.matches) || !parseInteger(p, end, row.inlierMatches)) return false;
+	if (!nextField(p, end, b, e)) return false;
+	row.hasPoint3D = (e - b == 4 && std::memcmp(b, "true", 4) == 0) || (e - b == 1 && *b == '1');
+	if (!nextField(p, end, b, e)) return false;
+	while (b < e && *b == ' ') b++;
+	if (e - b < 256) return false;
+	for (int i = 0; i < 128; i++) {
+		const int hi = hexValue(b[2*i]), lo = hexValue(b[2*i+1]);
+		if (hi < 0 || lo < 0) return false;
+		row.descriptor[i] = uint8_t(16*hi + lo);
+	}
+	return true;
+}
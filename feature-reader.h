@@ -0,0 +1,69 @@
+#ifndef FEATURE_READER_H
+#define FEATURE_READER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//
+// One row of the features CSV written by feature-data:
+// N,IMGNAME,IMGID,I,KX,KY,A11,A12,A21,A22,MATCHES,INLIERS,HASPT3D,DESC
+//
+struct FeatureRow {
+	int64_t num;
+	std::string_view imageName;   // points into the FeatureBlock it was parsed from
+	uint32_t imageId;
+	uint32_t index;
+	float kx, ky;
+	float a11, a12, a21, a22;
+	int32_t matches;
+	int32_t inlierMatches;
+	bool hasPoint3D;
+	uint8_t descriptor[128];
+};
+
+//
+// A block of raw CSV lines. Lines are kept as text so that they can be
+// parsed in parallel, and the block's storage is reused from block to
+// block, so reading does not allocate per row.
+//
+struct FeatureBlock {
+	std::string text;
+	std::vector<size_t> lineStarts;   // lineStarts[i] .. lineStarts[i+1]-1 is line i (without '\n')
+
+	size_t Size() const { return lineStarts.empty() ? 0 : lineStarts.size() - 1; }
+	const char* LineBegin(size_t i) const { return text.data() + lineStarts[i]; }
+	const char* LineEnd(size_t i) const { return text.data() + lineStarts[i+1] - 1; }
+};
+
+//
+// Streams the data lines of a features CSV, skipping header lines
+// (split CSV files may contain more than one), comments and empty lines.
+//
+class FeatureReader {
+public:
+	explicit FeatureReader(const std::string& path);
+
+	bool IsOpen() const { return is.is_open(); }
+
+	// Reads up to maxRows lines into block; returns the number read (0 at the end).
+	size_t ReadBlock(FeatureBlock& block, size_t maxRows);
+
+	// Number of bytes read so far.
+	size_t BytesRead() const { return bytesRead; }
+
+private:
+	std::ifstream is;
+	std::string line;
+	size_t bytesRead = 0;
+};
+
+//
+// Parses line [begin,end) into row. Returns false if the line is malformed.
+//
+bool parseFeatureRow(const char* begin, const char* end, FeatureRow& row);
+
+#endif // FEATURE_READER_H
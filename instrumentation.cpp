@@ -0,0 +1,351 @@
+#include "instrumentation.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+#if defined(ALLOCATION_ACCOUNTING)
+#include <cstring>
+#include <new>
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Event {
+	std::string name;
+	char phase;            // 'X' (complete) or 'C' (counter)
+	double ts, dur;        // microseconds since the trace started
+	int tid;
+	std::vector<std::pair<const char*,double>> args;
+};
+
+bool enabled = false;
+std::string tracePath;
+const Clock::time_point traceStart = Clock::now();
+std::mutex mutex;
+std::vector<Event> events;
+std::map<std::thread::id,int> threadIds;
+std::map<std::string,double> counters;
+
+double microseconds(Clock::time_point t) {
+	return std::chrono::duration<double,std::micro>(t - traceStart).count();
+}
+
+// called with mutex held
+int threadId() {
+	auto iter = threadIds.find(std::this_thread::get_id());
+	if (iter == threadIds.end())
+		iter = threadIds.insert({std::this_thread::get_id(), int(threadIds.size())}).first;
+	return iter->second;
+}
+
+size_t currentRSS() {
+#if defined(__APPLE__)
+	mach_task_basic_info info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS)
+		return 0;
+	return info.resident_size;
+#else
+	long pages = 0, residentPages = 0;
+	FILE* file = std::fopen("/proc/self/statm", "r");
+	if (file == nullptr) return 0;
+	const int n = std::fscanf(file, "%ld %ld", &pages, &residentPages);
+	std::fclose(file);
+	return n == 2 ? size_t(residentPages) * size_t(sysconf(_SC_PAGESIZE)) : 0;
+#endif
+}
+
+//
+// Peaks of the running stages. While tracing, a thread samples the
+// resident set size every millisecond and raises the peaks of all
+// running stages, whichever thread they run on; stages also sample at
+// their start and end. Unlike resetting the kernel's high-water mark,
+// this leaves the process' own peak (ru_maxrss, which a parent sees
+// through wait4) intact, at the cost of missing spikes shorter than
+// the sampling period.
+//
+std::mutex peakMutex;
+std::vector<size_t*> runningPeaks;
+std::atomic<bool> sampling{false};
+std::thread sampler;
+
+void samplePeaks(size_t rss) {
+	std::lock_guard<std::mutex> lock(peakMutex);
+	for (size_t* p : runningPeaks)
+		*p = std::max(*p, rss);
+}
+
+void stopSampler() {
+	sampling = false;
+	if (sampler.joinable())
+		sampler.join();
+}
+
+void startSampler() {
+	sampling = true;
+	sampler = std::thread([]() {
+		while (sampling) {
+			samplePeaks(currentRSS());
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+	std::atexit(stopSampler);
+}
+
+void startPeak(size_t& peak) {
+	const size_t rss = currentRSS();
+	std::lock_guard<std::mutex> lock(peakMutex);
+	peak = rss;
+	runningPeaks.push_back(&peak);
+}
+
+void endPeak(size_t& peak, size_t rss) {
+	std::lock_guard<std::mutex> lock(peakMutex);
+	peak = std::max(peak, rss);
+	runningPeaks.erase(std::find(runningPeaks.begin(), runningPeaks.end(), &peak));
+}
+
+std::string escaped(const std::string& s) {
+	std::string out;
+	for (char c : s) {
+		if (c == '"' || c == '\\') out += '\\';
+		if (c == '\n') { out += "\\n"; continue; }
+		out += c;
+	}
+	return out;
+}
+
+void writeTrace() {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::ofstream os(tracePath);
+	if (!os.is_open()) {
+		std::cerr << "Unable to open '" << tracePath << "' for writing!\n";
+		return;
+	}
+	os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	for (size_t i = 0; i < events.size(); i++) {
+		const Event& e = events[i];
+		os << "{\"name\":\"" << escaped(e.name) << "\",\"ph\":\"" << e.phase << "\",\"pid\":1,\"tid\":" << e.tid
+		   << ",\"ts\":" << std::fixed << e.ts;
+		if (e.phase == 'X')
+			os << ",\"dur\":" << e.dur;
+		os << ",\"args\":{";
+		for (size_t a = 0; a < e.args.size(); a++)
+			os << (a > 0 ? "," : "") << "\"" << e.args[a].first << "\":" << e.args[a].second;
+		os << "}}" << (i + 1 < events.size() ? ",\n" : "\n");
+	}
+	os << "]}\n";
+}
+
+} // namespace
+
+#if defined(ALLOCATION_ACCOUNTING)
+
+//
+// Allocation accounting. The hooks must not allocate, so the stages live
+// in a fixed table of atomics, looked up by name. Sizes are taken from
+// the allocator (malloc_usable_size) rather than a header, so they
+// include the allocator's rounding. Stage 0 collects the allocations
+// made outside of any stage.
+//
+namespace {
+
+constexpr int maxAllocationStages = 128;
+
+struct AllocationStats {
+	std::atomic<size_t> allocations{0};
+	std::atomic<size_t> allocatedBytes{0};
+	std::atomic<size_t> frees{0};
+	std::atomic<size_t> freedBytes{0};
+	// of the process-wide live heap bytes, as observed on the stage's thread
+	std::atomic<long long> observedHighWater{0};
+};
+
+AllocationStats allocationStats[maxAllocationStages];
+const char* allocationStageNames[maxAllocationStages] = {"(no stage)"};
+std::atomic<int> numAllocationStages{1};
+std::mutex allocationStagesMutex;
+std::atomic<long long> liveBytes{0};
+thread_local int currentAllocationStage = 0;
+
+size_t allocationSize(void* p) {
+#if defined(__APPLE__)
+	return malloc_size(p);
+#else
+	return malloc_usable_size(p);
+#endif
+}
+
+void raiseHighWater(AllocationStats& stats, long long value) {
+	long long highWater = stats.observedHighWater.load(std::memory_order_relaxed);
+	while (value > highWater &&
+		   !stats.observedHighWater.compare_exchange_weak(highWater, value, std::memory_order_relaxed))
+		;
+}
+
+void* recordAllocation(void* p) {
+	if (p == nullptr) return p;
+	const size_t size = allocationSize(p);
+	AllocationStats& stats = allocationStats[currentAllocationStage];
+	stats.allocations.fetch_add(1, std::memory_order_relaxed);
+	stats.allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	raiseHighWater(stats, liveBytes.fetch_add(size, std::memory_order_relaxed) + (long long)size);
+	return p;
+}
+
+void recordFree(void* p) {
+	const size_t size = allocationSize(p);
+	AllocationStats& stats = allocationStats[currentAllocationStage];
+	stats.frees.fetch_add(1, std::memory_order_relaxed);
+	stats.freedBytes.fetch_add(size, std::memory_order_relaxed);
+	liveBytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+int findAllocationStage(const char* name) {
+	const int n = numAllocationStages.load(std::memory_order_acquire);
+	for (int i = 1; i < n; i++)
+		if (std::strcmp(allocationStageNames[i], name) == 0)
+			return i;
+	std::lock_guard<std::mutex> lock(allocationStagesMutex);
+	const int m = numAllocationStages.load(std::memory_order_relaxed);
+	for (int i = n; i < m; i++)
+		if (std::strcmp(allocationStageNames[i], name) == 0)
+			return i;
+	if (m == maxAllocationStages)
+		return 0;
+	allocationStageNames[m] = name;
+	numAllocationStages.store(m + 1, std::memory_order_release);
+	return m;
+}
+
+void printAllocationReport() {
+	const double megabyte = 1024.0 * 1024.0;
+	std::fprintf(stderr, "\n%-24s %14s %12s %14s %12s %17s\n",
+				 "stage", "allocations", "alloc MB", "frees", "freed MB", "observed high MB");
+	const int n = numAllocationStages.load();
+	for (int i = 0; i < n; i++) {
+		const AllocationStats& stats = allocationStats[i];
+		std::fprintf(stderr, "%-24s %14zu %12.1f %14zu %12.1f %17.1f\n",
+					 allocationStageNames[i],
+					 stats.allocations.load(), stats.allocatedBytes.load() / megabyte,
+					 stats.frees.load(), stats.freedBytes.load() / megabyte,
+					 stats.observedHighWater.load() / megabyte);
+	}
+}
+
+struct AllocationReport {
+	~AllocationReport() { printAllocationReport(); }
+} allocationReport;
+
+void* allocate(size_t size) {
+	void* p = std::malloc(size > 0 ? size : 1);
+	if (p == nullptr) throw std::bad_alloc();
+	return recordAllocation(p);
+}
+
+void* allocateAligned(size_t size, std::align_val_t alignment) {
+	void* p = nullptr;
+	const size_t a = std::max(sizeof(void*), size_t(alignment));
+	if (posix_memalign(&p, a, size > 0 ? size : 1) != 0) throw std::bad_alloc();
+	return recordAllocation(p);
+}
+
+void deallocate(void* p) {
+	if (p == nullptr) return;
+	recordFree(p);
+	std::free(p);
+}
+
+} // namespace
+
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return recordAllocation(std::malloc(size > 0 ? size : 1)); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return recordAllocation(std::malloc(size > 0 ? size : 1)); }
+void* operator new(size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment); }
+
+void operator delete(void* p) noexcept { deallocate(p); }
+void operator delete[](void* p) noexcept { deallocate(p); }
+void operator delete(void* p, size_t) noexcept { deallocate(p); }
+void operator delete[](void* p, size_t) noexcept { deallocate(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { deallocate(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { deallocate(p); }
+void operator delete(void* p, std::align_val_t) noexcept { deallocate(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { deallocate(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { deallocate(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { deallocate(p); }
+
+#endif // ALLOCATION_ACCOUNTING
+
+void enableTrace(const std::string& path) {
+	if (!enabled) {
+		std::atexit(writeTrace);
+		startSampler();   // stopped before the trace is written
+	}
+	tracePath = path;
+	enabled = true;
+}
+
+bool traceEnabled() {
+	return enabled;
+}
+
+void traceCounter(const char* name, double delta) {
+	if (!enabled) return;
+	const double ts = microseconds(Clock::now());
+	std::lock_guard<std::mutex> lock(mutex);
+	const double total = counters[name] += delta;
+	events.push_back({name, 'C', ts, 0, threadId(), {{"value", total}}});
+}
+
+TraceStage::TraceStage(const char* name) : name(name), enabled(::enabled) {
+#if defined(ALLOCATION_ACCOUNTING)
+	allocationStage = findAllocationStage(name);
+	parentAllocationStage = currentAllocationStage;
+	currentAllocationStage = allocationStage;
+	raiseHighWater(allocationStats[allocationStage], liveBytes.load(std::memory_order_relaxed));
+#endif
+	if (!enabled) return;
+	startPeak(peakRSS);
+	startRSS = currentRSS();
+	start = Clock::now();
+}
+
+TraceStage::~TraceStage() {
+#if defined(ALLOCATION_ACCOUNTING)
+	currentAllocationStage = parentAllocationStage;
+	raiseHighWater(allocationStats[parentAllocationStage], allocationStats[allocationStage].observedHighWater.load());
+#endif
+	if (!enabled) return;
+	const Clock::time_point end = Clock::now();
+	const size_t rss = currentRSS();
+	endPeak(peakRSS, rss);
+	const double megabyte = 1024.0 * 1024.0;
+	Event e{name, 'X', microseconds(start), std::chrono::duration<double,std::micro>(end - start).count(), 0,
+			{{"rows", double(rows)},
+			 {"bytes", double(bytes)},
+			 {"rssMB", double(rss) / megabyte},
+			 {"rssDeltaMB", (double(rss) - double(startRSS)) / megabyte},
+			 {"peakRssMB", double(peakRSS) / megabyte}}};
+	std::lock_guard<std::mutex> lock(mutex);
+	e.tid = threadId();
+	events.push_back(std::move(e));
+}
@@ -0,0 +1,63 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+//
+// Lightweight tracing shared by the tools. When enabled (each tool's -t
+// flag), named stages, counters and memory use are recorded and written
+// as a Chrome trace (chrome://tracing, https://ui.perfetto.dev) when the
+// program exits. When disabled every call is a test of a flag.
+//
+void enableTrace(const std::string& path);
+bool traceEnabled();
+
+//
+// Adds delta to the named counter and records its running total.
+//
+void traceCounter(const char* name, double delta);
+
+//
+// Times a stage from construction to destruction. The trace event
+// carries the rows and bytes the stage processed, the resident set size
+// at its end, its change over the stage, and the peak resident set size
+// during the stage (sampled every millisecond). Stages may nest and may
+// run on any thread.
+//
+// In builds with ALLOCATION_ACCOUNTING defined (cmake -DALLOCATION_ACCOUNTING=ON)
+// global operator new/delete are replaced, and the allocations made while
+// a stage is the innermost one on its thread are attributed to it,
+// whether or not tracing is enabled. The number of allocations and bytes
+// allocated and freed of every stage are printed to stderr at exit, with
+// the highest process-wide live heap size observed on the stage's thread:
+// at the stage's start and its (and its children's) allocations. Peaks
+// reached by allocations on other threads are not seen, and frees are not
+// traced to the stage that allocated, so the live bytes are not
+// attributed to stages.
+//
+class TraceStage {
+public:
+	explicit TraceStage(const char* name);
+	~TraceStage();
+
+	TraceStage(const TraceStage&) = delete;
+	TraceStage& operator=(const TraceStage&) = delete;
+
+	void AddRows(size_t n) { rows += n; }
+	void AddBytes(size_t n) { bytes += n; }
+
+private:
+	const char* name;
+	bool enabled;
+	std::chrono::steady_clock::time_point start;
+	size_t startRSS = 0;
+	size_t peakRSS = 0;
+	size_t rows = 0;
+	size_t bytes = 0;
+	int allocationStage = 0;
+	int parentAllocationStage = 0;
+};
+
+#endif // INSTRUMENTATION_H
@@ -0,0 +1,180 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <unistd.h>
+#include <colmap/base/database.h>
+#include "descriptor-matcher.h"
+#include "instrumentation.h"
+
+//
+// Recomputes per keypoint match labels with a brute force CPU matcher
+// instead of the matcher that built the database. Every image pair
+// (or, with -w, every pair at most that many images apart in database
+// order) is matched both ways, and for each keypoint it counts
+//
+//   RATIO   the images in which its nearest neighbour passes the ratio test
+//   MUTUAL  the images in which it and its nearest neighbour are each
+//           other's nearest neighbours
+//
+// The output has the N,IMGNAME,IMGID,I numbering of feature-data, so the
+// two can be joined row by row.
+//
+int main(int argc, char *argv[]) {
+    size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    double ratio = 0.8;
+    size_t window = 0;   // 0 => exhaustive
+
+    auto usage = [&]() {
+        std::cerr << "usage: " << argv[0] << " [-j threads] [-r ratio] [-w window] [-t trace.json] "
+                  << "database.db counts.csv\n";
+        exit(-1);
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:r:w:t:")) != -1) {
+        switch (opt) {
+        case 'j': numThreads = std::max(1, std::atoi(optarg)); break;
+        case 'r': ratio = std::atof(optarg); break;
+        case 'w': window = size_t(std::max(0, std::atoi(optarg))); break;
+        case 't': enableTrace(optarg); break;
+        default: usage();
+        }
+    }
+    if (argc - optind != 2 || ratio <= 0 || ratio > 1)
+        usage();
+
+    const std::string databasePath(argv[optind]);
+    const std::string countsCSV(argv[optind+1]);
+
+    std::ifstream databaseFile(databasePath);
+    if (!databaseFile.is_open()) {
+        std::cerr << "Database '" << databasePath << "' does not exist!\n";
+        exit(-1);
+    }
+    databaseFile.close();
+
+    //
+    // All descriptors in one buffer; image k's keypoints are rows
+    // offsets[k] .. offsets[k+1]-1.
+    //
+    colmap::Database database(databasePath);
+    std::vector<colmap::Image> images;
+    std::vector<size_t> offsets;
+    std::vector<uint8_t> descriptors;
+    std::vector<int32_t> norms;
+    {
+        TraceStage stage("descriptor read");
+        images = database.ReadAllImages();
+        offsets.push_back(0);
+        for (auto&& image : images)
+            offsets.push_back(offsets.back() + database.NumKeypointsForImage(image.ImageId()));
+        descriptors.resize(offsets.back() * 128);
+        for (size_t k = 0; k < images.size(); k++) {
+            const colmap::FeatureDescriptors imageDescriptors = database.ReadDescriptors(images[k].ImageId());
+            if (size_t(imageDescriptors.rows()) != offsets[k+1] - offsets[k] ||
+                (imageDescriptors.rows() > 0 && imageDescriptors.cols() != 128)) {
+                std::cerr << "Image " << images[k].ImageId() << " has " << offsets[k+1] - offsets[k]
+                          << " keypoints but " << imageDescriptors.rows() << "x" << imageDescriptors.cols()
+                          << " descriptors\n";
+                exit(-1);
+            }
+            std::copy(imageDescriptors.data(), imageDescriptors.data() + imageDescriptors.size(),
+                      descriptors.data() + offsets[k] * 128);
+        }
+        norms.resize(offsets.back());
+        descriptorNorms(descriptors.data(), offsets.back(), norms.data());
+        stage.AddRows(offsets.back());
+        stage.AddBytes(descriptors.size());
+    }
+    std::cout << images.size() << " images, " << offsets.back() << " keypoints\n";
+
+    std::vector<std::atomic<uint32_t>> ratioCounts(offsets.back());
+    std::vector<std::atomic<uint32_t>> mutualCounts(offsets.back());
+
+    //
+    // Thread pool over images: a task matches image a with the images
+    // after it (within the window). Tasks are handed out in order, so the
+    // largest ones of an exhaustive run start first.
+    //
+    {
+        TraceStage stage("match");
+        const size_t numImages = images.size();
+        std::atomic<size_t> nextImage(0);
+        std::atomic<size_t> pairsDone(0);
+        const size_t numPairs = [&]() {
+            size_t pairs = 0;
+            for (size_t a = 0; a < numImages; a++)
+                pairs += std::min(numImages, window > 0 ? a + 1 + window : numImages) - (a + 1);
+            return pairs;
+        }();
+
+        auto work = [&](size_t t) {
+            NearestNeighbors ab, ba;
+            size_t a;
+            while ((a = nextImage++) < numImages) {
+                const size_t last = std::min(numImages, window > 0 ? a + 1 + window : numImages);
+                for (size_t b = a + 1; b < last; b++) {
+                    const size_t na = offsets[a+1] - offsets[a], nb = offsets[b+1] - offsets[b];
+                    nearestNeighbors(descriptors.data() + offsets[a]*128, norms.data() + offsets[a], na,
+                                     descriptors.data() + offsets[b]*128, norms.data() + offsets[b], nb,
+                                     ab, ba);
+                    for (size_t i = 0; i < na; i++)
+                        if (ab.PassesRatioTest(i, ratio))
+                            ratioCounts[offsets[a] + i].fetch_add(1, std::memory_order_relaxed);
+                    for (size_t j = 0; j < nb; j++)
+                        if (ba.PassesRatioTest(j, ratio))
+                            ratioCounts[offsets[b] + j].fetch_add(1, std::memory_order_relaxed);
+                    for (size_t i = 0; i < na; i++) {
+                        if (nb == 0 || ba.best[ab.best[i]] != i) continue;
+                        mutualCounts[offsets[a] + i].fetch_add(1, std::memory_order_relaxed);
+                        mutualCounts[offsets[b] + ab.best[i]].fetch_add(1, std::memory_order_relaxed);
+                    }
+                    const size_t done = ++pairsDone;
+                    if (t == 0)
+                        std::cout << "\r" << done << " of " << numPairs << " image pairs matched" << std::flush;
+                }
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < numThreads; t++)
+            threads.emplace_back(work, t);
+        work(0);
+        for (auto&& thread : threads)
+            thread.join();
+        std::cout << "\r" << numPairs << " of " << numPairs << " image pairs matched\n";
+        stage.AddRows(numPairs);
+        traceCounter("pairs", numPairs);
+    }
+
+    TraceStage csvStage("CSV write");
+    std::ofstream csv(countsCSV);
+    if (!csv.is_open()) {
+        std::cerr << "Unable to open '" << countsCSV << "' for writing!\n";
+        exit(-1);
+    }
+    csv << "N,IMGNAME,IMGID,I,RATIO,MUTUAL\n";
+    size_t n = 0, withRatio = 0, withMutual = 0;
+    for (size_t k = 0; k < images.size(); k++) {
+        for (size_t i = 0; i < offsets[k+1] - offsets[k]; i++) {
+            const uint32_t ratioCount = ratioCounts[n], mutualCount = mutualCounts[n];
+            if (ratioCount > 0) withRatio++;
+            if (mutualCount > 0) withMutual++;
+            csv << n << "," << images[k].Name() << "," << images[k].ImageId() << "," << i << ","
+                << ratioCount << "," << mutualCount << "\n";
+            n++;
+        }
+    }
+    csvStage.AddRows(n);
+    csvStage.AddBytes(size_t(csv.tellp()));
+
+    std::cout << "features w ratio test matches...." << withRatio << "\n"
+              << "features w mutual matches........" << withMutual << "\n";
+
+    return 0;
+}
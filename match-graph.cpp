@@ -0,0 +1,211 @@
+#include "match-graph.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+size_t align64(size_t offset) {
+	return (offset + 63) & ~size_t(63);
+}
+
+struct Header {
+	char magic[4];
+	uint32_t version;
+	uint32_t numImages, numPairs, hasMatchIndices, reserved;
+};
+
+//
+// Section offsets of a match graph file, shared by the writer and the
+// reader. The match sections depend on the total numbers of matches,
+// which are only known once the offsets have been read.
+//
+struct Layout {
+	size_t imageIds, rowOffsets, edges, matchOffsets, inlierOffsets, matches, inliers, size;
+
+	Layout(size_t numImages, size_t numPairs, bool hasMatchIndices, uint64_t numMatches, uint64_t numInliers) {
+		imageIds = align64(sizeof(Header));
+		rowOffsets = align64(imageIds + numImages*sizeof(uint32_t));
+		edges = align64(rowOffsets + (numImages + 1)*sizeof(uint64_t));
+		size = edges + 2*numPairs*sizeof(MatchGraph::Edge);
+		if (hasMatchIndices) {
+			matchOffsets = align64(size);
+			inlierOffsets = align64(matchOffsets + (numPairs + 1)*sizeof(uint64_t));
+			matches = align64(inlierOffsets + (numPairs + 1)*sizeof(uint64_t));
+			inliers = align64(matches + numMatches*sizeof(MatchGraph::Match));
+			size = inliers + numInliers*sizeof(MatchGraph::Match);
+		} else {
+			matchOffsets = inlierOffsets = matches = inliers = size;
+		}
+	}
+};
+
+} // namespace
+
+MatchGraph::~MatchGraph() {
+	if (mapping)
+		munmap(mapping, mappingSize);
+}
+
+bool MatchGraph::Open(const std::string& path) {
+	const int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+		close(fd);
+		return false;
+	}
+	mappingSize = size_t(st.st_size);
+	mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		mapping = nullptr;
+		return false;
+	}
+	const char* base = static_cast<const char*>(mapping);
+	Header header;
+	std::memcpy(&header, base, sizeof(header));
+	if (std::memcmp(header.magic, "FCMG", 4) != 0 || header.version != 1)
+		return false;
+	numImages = header.numImages;
+	numPairs = header.numPairs;
+
+	const Layout counts(numImages, numPairs, header.hasMatchIndices, 0, 0);
+	if (mappingSize < counts.size)
+		return false;
+	imageIds = reinterpret_cast<const uint32_t*>(base + counts.imageIds);
+	rowOffsets = reinterpret_cast<const uint64_t*>(base + counts.rowOffsets);
+	edges = reinterpret_cast<const Edge*>(base + counts.edges);
+	if (rowOffsets[numImages] != 2*numPairs)
+		return false;
+	if (header.hasMatchIndices) {
+		const uint64_t* matchEnd = reinterpret_cast<const uint64_t*>(base + counts.matchOffsets) + numPairs;
+		const uint64_t* inlierEnd = reinterpret_cast<const uint64_t*>(base + counts.inlierOffsets) + numPairs;
+		const Layout layout(numImages, numPairs, true, *matchEnd, *inlierEnd);
+		if (mappingSize < layout.size)
+			return false;
+		matchOffsets = reinterpret_cast<const uint64_t*>(base + layout.matchOffsets);
+		inlierOffsets = reinterpret_cast<const uint64_t*>(base + layout.inlierOffsets);
+		matches = reinterpret_cast<const Match*>(base + layout.matches);
+		inliers = reinterpret_cast<const Match*>(base + layout.inliers);
+	}
+	return true;
+}
+
+long MatchGraph::ImageIndex(uint32_t imageId) const {
+	const uint32_t* end = imageIds + numImages;
+	const uint32_t* iter = std::lower_bound(imageIds, end, imageId);
+	return (iter != end && *iter == imageId) ? long(iter - imageIds) : -1;
+}
+
+const MatchGraph::Edge* MatchGraph::FindEdge(size_t a, size_t b) const {
+	const Edge* end = EdgesEnd(a);
+	const Edge* iter = std::lower_bound(EdgesBegin(a), end, b, [](const Edge& edge, size_t image) {
+		return edge.neighbor < image;
+	});
+	return (iter != end && iter->neighbor == b) ? iter : nullptr;
+}
+
+void MatchGraphBuilder::AddImage(uint32_t imageId) {
+	imageIds.push_back(imageId);
+}
+
+void MatchGraphBuilder::AddPair(uint32_t imageId1, uint32_t imageId2,
+                                const std::vector<MatchGraph::Match>& matches,
+                                const std::vector<MatchGraph::Match>& inliers) {
+	Pair pair;
+	pair.imageId1 = std::min(imageId1, imageId2);
+	pair.imageId2 = std::max(imageId1, imageId2);
+	pair.numMatches = uint32_t(matches.size());
+	pair.numInliers = uint32_t(inliers.size());
+	if (withMatchIndices) {
+		pair.matches = matches;
+		pair.inliers = inliers;
+		if (imageId1 > imageId2) {
+			for (auto&& match : pair.matches) std::swap(match.point2D_idx1, match.point2D_idx2);
+			for (auto&& match : pair.inliers) std::swap(match.point2D_idx1, match.point2D_idx2);
+		}
+	}
+	pairs.push_back(std::move(pair));
+}
+
+bool MatchGraphBuilder::Write(const std::string& path) const {
+	std::vector<uint32_t> ids = imageIds;
+	std::sort(ids.begin(), ids.end());
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+	auto indexOf = [&](uint32_t imageId) {
+		return uint32_t(std::lower_bound(ids.begin(), ids.end(), imageId) - ids.begin());
+	};
+
+	std::vector<const Pair*> sorted;
+	for (auto&& pair : pairs) {
+		if (!std::binary_search(ids.begin(), ids.end(), pair.imageId1) ||
+			!std::binary_search(ids.begin(), ids.end(), pair.imageId2))
+			return false;
+		sorted.push_back(&pair);
+	}
+	std::sort(sorted.begin(), sorted.end(), [](const Pair* a, const Pair* b) {
+		return std::make_pair(a->imageId1, a->imageId2) < std::make_pair(b->imageId1, b->imageId2);
+	});
+
+	std::vector<std::vector<MatchGraph::Edge>> rows(ids.size());
+	uint64_t numMatches = 0, numInliers = 0;
+	for (uint32_t p = 0; p < sorted.size(); p++) {
+		const Pair& pair = *sorted[p];
+		const uint32_t a = indexOf(pair.imageId1), b = indexOf(pair.imageId2);
+		rows[a].push_back({b, pair.numMatches, pair.numInliers, p});
+		rows[b].push_back({a, pair.numMatches, pair.numInliers, p});
+		numMatches += pair.matches.size();
+		numInliers += pair.inliers.size();
+	}
+	std::vector<uint64_t> rowOffsets(1, 0);
+	for (auto&& row : rows) {
+		std::sort(row.begin(), row.end(), [](const MatchGraph::Edge& a, const MatchGraph::Edge& b) {
+			return a.neighbor < b.neighbor;
+		});
+		rowOffsets.push_back(rowOffsets.back() + row.size());
+	}
+
+	const Layout layout(ids.size(), sorted.size(), withMatchIndices, numMatches, numInliers);
+	std::ofstream os(path, std::ios::binary);
+	if (!os.is_open()) return false;
+	auto seek = [&](size_t offset) {
+		static const char zeros[64] = {};
+		os.write(zeros, offset - size_t(os.tellp()));
+	};
+	auto write = [&](const auto& values) {
+		os.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(values[0]));
+	};
+	const Header header = {{'F','C','M','G'}, 1, uint32_t(ids.size()), uint32_t(sorted.size()),
+	                       uint32_t(withMatchIndices), 0};
+	os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	seek(layout.imageIds);
+	write(ids);
+	seek(layout.rowOffsets);
+	write(rowOffsets);
+	seek(layout.edges);
+	for (auto&& row : rows)
+		write(row);
+	if (withMatchIndices) {
+		std::vector<uint64_t> matchOffsets(1, 0), inlierOffsets(1, 0);
+		for (const Pair* pair : sorted) {
+			matchOffsets.push_back(matchOffsets.back() + pair->matches.size());
+			inlierOffsets.push_back(inlierOffsets.back() + pair->inliers.size());
+		}
+		seek(layout.matchOffsets);
+		write(matchOffsets);
+		seek(layout.inlierOffsets);
+		write(inlierOffsets);
+		seek(layout.matches);
+		for (const Pair* pair : sorted)
+			write(pair->matches);
+		seek(layout.inliers);
+		for (const Pair* pair : sorted)
+			write(pair->inliers);
+	}
+	return bool(os);
+}
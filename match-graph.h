@@ -0,0 +1,116 @@
+#ifndef MATCH_GRAPH_H
+#define MATCH_GRAPH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//
+// The image match graph of a COLMAP database in compressed sparse row
+// form: for every image, its matched images with the raw and inlier
+// match counts of each pair, and optionally the match index pairs
+// themselves. Built once by build-match-graph and memory mapped by the
+// tools, so that pair lookups do not go through SQLite.
+//
+// The file format is little-endian binary, every section starting on a
+// 64 byte boundary:
+//
+//   char[4]  "FCMG"
+//   uint32   version (1)
+//   uint32   numImages, numPairs, hasMatchIndices, 0
+//   uint32   imageIds[numImages]            ascending
+//   uint64   rowOffsets[numImages+1]        into edges
+//   Edge     edges[2*numPairs]              both directions, by neighbour
+//   if hasMatchIndices:
+//     uint64 matchOffsets[numPairs+1], inlierOffsets[numPairs+1]
+//     Match  matches[], inliers[]
+//
+// The matches of a pair are oriented from its smaller image id to its
+// larger one, like COLMAP stores them.
+//
+class MatchGraph {
+public:
+	struct Edge {
+		uint32_t neighbor;   // image index (not id) of the other image
+		uint32_t matches;    // raw matches
+		uint32_t inliers;    // two view geometry inlier matches
+		uint32_t pair;       // index of the (undirected) pair
+	};
+
+	struct Match {
+		uint32_t point2D_idx1, point2D_idx2;
+	};
+
+	MatchGraph() = default;
+	MatchGraph(const MatchGraph&) = delete;
+	MatchGraph& operator=(const MatchGraph&) = delete;
+	~MatchGraph();
+
+	bool Open(const std::string& path);
+
+	size_t NumImages() const { return numImages; }
+	size_t NumPairs() const { return numPairs; }
+	bool HasMatchIndices() const { return matchOffsets != nullptr; }
+
+	uint32_t ImageId(size_t image) const { return imageIds[image]; }
+
+	// Index of an image id, or -1 if the image is not in the graph.
+	long ImageIndex(uint32_t imageId) const;
+
+	const Edge* EdgesBegin(size_t image) const { return edges + rowOffsets[image]; }
+	const Edge* EdgesEnd(size_t image) const { return edges + rowOffsets[image+1]; }
+
+	// The edge from image index a to image index b, or nullptr.
+	const Edge* FindEdge(size_t a, size_t b) const;
+
+	// Match index pairs of a pair (requires HasMatchIndices()).
+	const Match* MatchesBegin(uint32_t pair) const { return matches + matchOffsets[pair]; }
+	const Match* MatchesEnd(uint32_t pair) const { return matches + matchOffsets[pair+1]; }
+	const Match* InliersBegin(uint32_t pair) const { return inliers + inlierOffsets[pair]; }
+	const Match* InliersEnd(uint32_t pair) const { return inliers + inlierOffsets[pair+1]; }
+
+private:
+	void *mapping = nullptr;
+	size_t mappingSize = 0;
+	size_t numImages = 0, numPairs = 0;
+	const uint32_t* imageIds = nullptr;
+	const uint64_t* rowOffsets = nullptr;
+	const Edge* edges = nullptr;
+	const uint64_t* matchOffsets = nullptr;
+	const uint64_t* inlierOffsets = nullptr;
+	const Match* matches = nullptr;
+	const Match* inliers = nullptr;
+};
+
+//
+// Collects the pairs of a match graph and writes its file. Without match
+// indices only the counts of each pair are kept.
+//
+class MatchGraphBuilder {
+public:
+	explicit MatchGraphBuilder(bool withMatchIndices) : withMatchIndices(withMatchIndices) {}
+
+	void AddImage(uint32_t imageId);
+
+	// matches and inliers oriented from imageId1 to imageId2
+	void AddPair(uint32_t imageId1, uint32_t imageId2,
+	             const std::vector<MatchGraph::Match>& matches,
+	             const std::vector<MatchGraph::Match>& inliers);
+
+	// False if the file cannot be written or a pair refers to an image
+	// that was not added.
+	bool Write(const std::string& path) const;
+
+private:
+	struct Pair {
+		uint32_t imageId1, imageId2;   // imageId1 < imageId2
+		uint32_t numMatches, numInliers;
+		std::vector<MatchGraph::Match> matches, inliers;
+	};
+	bool withMatchIndices;
+	std::vector<uint32_t> imageIds;
+	std::vector<Pair> pairs;
+};
+
+#endif // MATCH_GRAPH_H
@@ -0,0 +1,306 @@
+#include "matchability-model.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+void frameInputs(const FeatureRow& row, float inputs[numFrameInputs]) {
+	//
+	// Singular values of A from the closed form for 2x2 matrices.
+	//
+	const double a = row.a11, b = row.a12, c = row.a21, d = row.a22;
+	const double e = (a + d) / 2, f = (a - d) / 2, g = (c + b) / 2, h = (c - b) / 2;
+	const double q = std::sqrt(e*e + h*h), r = std::sqrt(f*f + g*g);
+	const double s1 = q + r, s2 = std::abs(q - r);
+	const double tiny = 1e-6;
+	inputs[0] = row.kx;
+	inputs[1] = row.ky;
+	inputs[2] = float(0.5 * std::log(std::max(s1 * s2, tiny)));
+	inputs[3] = float(std::log(std::max(s1, tiny) / std::max(s2, tiny)));
+	const double orientation = std::atan2(c, a);
+	inputs[4] = float(std::cos(orientation));
+	inputs[5] = float(std::sin(orientation));
+}
+
+namespace {
+
+template <class T>
+void writeValue(std::ofstream& os, const T& value) {
+	os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <class T>
+bool readValue(std::ifstream& is, T& value) {
+	return bool(is.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+void writeFloats(std::ofstream& os, const std::vector<float>& values) {
+	os.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+}
+
+bool readFloats(std::ifstream& is, std::vector<float>& values, size_t n) {
+	values.resize(n);
+	return bool(is.read(reinterpret_cast<char*>(values.data()), n * sizeof(float)));
+}
+
+} // namespace
+
+bool DescriptorBasis::Read(const std::string& path) {
+	std::ifstream is(path, std::ios::binary);
+	char magic[4];
+	uint32_t dims;
+	if (!is.read(magic, 4) || std::memcmp(magic, "FCPB", 4) != 0 || !readValue(is, dims) || dims != 128)
+		return false;
+	return readFloats(is, mean, 128) && readFloats(is, components, 128*128) && readFloats(is, eigenvalues, 128);
+}
+
+//
+// Format: char[4] "FCPB", uint32 128, float mean[128],
+// float components[128][128], float eigenvalues[128].
+//
+bool DescriptorBasis::Write(const std::string& path) const {
+	std::ofstream os(path, std::ios::binary);
+	if (!os.is_open()) return false;
+	os.write("FCPB", 4);
+	writeValue<uint32_t>(os, 128);
+	writeFloats(os, mean);
+	writeFloats(os, components);
+	writeFloats(os, eigenvalues);
+	return bool(os);
+}
+
+void MatchabilityModel::Inputs(const FeatureRow& row, float* inputs) const {
+	if (pcaDims > 0) {
+		float centered[128];
+		for (int c = 0; c < 128; c++)
+			centered[c] = row.descriptor[c] - pcaMean[c];
+		for (int k = 0; k < pcaDims; k++) {
+			const float* component = &pcaComponents[size_t(k)*128];
+			float sum = 0;
+			for (int c = 0; c < 128; c++)
+				sum += component[c] * centered[c];
+			inputs[k] = sum;
+		}
+	} else {
+		for (int c = 0; c < 128; c++)
+			inputs[c] = row.descriptor[c];
+	}
+	frameInputs(row, inputs + (pcaDims > 0 ? pcaDims : 128));
+}
+
+float MatchabilityModel::Predict(const FeatureRow& row) const {
+	std::vector<float> activations(NumInputs());
+	Inputs(row, activations.data());
+	for (size_t k = 0; k < activations.size(); k++)
+		activations[k] = (activations[k] - inputMean[k]) / inputStd[k];
+	for (size_t l = 0; l < layers.size(); l++) {
+		const Layer& layer = layers[l];
+		std::vector<float> next(layer.out);
+		for (int o = 0; o < layer.out; o++) {
+			const float* W = &layer.weights[size_t(o)*layer.in];
+			float sum = layer.bias[o];
+			for (int i = 0; i < layer.in; i++)
+				sum += W[i] * activations[i];
+			next[o] = l + 1 < layers.size() ? std::max(sum, 0.0f) : sum;
+		}
+		activations.swap(next);
+	}
+	return 1.0f / (1.0f + std::exp(-activations[0]));
+}
+
+bool MatchabilityModel::Read(const std::string& path) {
+	std::ifstream is(path, std::ios::binary);
+	char magic[4];
+	uint32_t version, dims, numLayers;
+	if (!is.read(magic, 4) || std::memcmp(magic, "FCMM", 4) != 0 ||
+		!readValue(is, version) || version != 1 ||
+		!readValue(is, dims) || dims > 128 || !readValue(is, numLayers) || numLayers == 0)
+		return false;
+	pcaDims = int(dims);
+	if (pcaDims > 0 && (!readFloats(is, pcaMean, 128) || !readFloats(is, pcaComponents, size_t(pcaDims)*128)))
+		return false;
+	const int D = NumInputs();
+	if (!readFloats(is, inputMean, D) || !readFloats(is, inputStd, D))
+		return false;
+	layers.resize(numLayers);
+	int in = D;
+	for (auto&& layer : layers) {
+		uint32_t layerIn, layerOut;
+		if (!readValue(is, layerIn) || !readValue(is, layerOut) || int(layerIn) != in || layerOut == 0)
+			return false;
+		layer.in = int(layerIn);
+		layer.out = int(layerOut);
+		if (!readFloats(is, layer.weights, size_t(layer.in)*layer.out) || !readFloats(is, layer.bias, layer.out))
+			return false;
+		in = layer.out;
+	}
+	return in == 1;
+}
+
+bool MatchabilityModel::Write(const std::string& path) const {
+	std::ofstream os(path, std::ios::binary);
+	if (!os.is_open()) return false;
+	os.write("FCMM", 4);
+	writeValue<uint32_t>(os, 1);
+	writeValue<uint32_t>(os, pcaDims);
+	writeValue<uint32_t>(os, layers.size());
+	if (pcaDims > 0) {
+		writeFloats(os, pcaMean);
+		writeFloats(os, pcaComponents);
+	}
+	writeFloats(os, inputMean);
+	writeFloats(os, inputStd);
+	for (auto&& layer : layers) {
+		writeValue<uint32_t>(os, layer.in);
+		writeValue<uint32_t>(os, layer.out);
+		writeFloats(os, layer.weights);
+		writeFloats(os, layer.bias);
+	}
+	return bool(os);
+}
+
+MatchabilityScorer::MatchabilityScorer(const MatchabilityModel& model)
+	: layers(model.layers.begin() + 1, model.layers.end()) {
+	const MatchabilityModel::Layer& first = model.layers.front();
+	const int P = model.pcaDims > 0 ? model.pcaDims : 128;
+	hidden = first.out;
+	width = hidden;
+	for (auto&& layer : layers)
+		width = std::max(width, layer.out);
+
+	//
+	// h_j = sum_i W_ji (x_i - m_i) / s_i + b_j with x = [C (d - mu); frame]
+	//     = sum_c V_jc d_c + sum_k F_jk frame_k + b_j - sum_i W_ji m_i / s_i - sum_c V_jc mu_c
+	//
+	auto inverseStd = [&](int i) {
+		return model.inputStd[i] > 0 ? 1.0 / model.inputStd[i] : 1.0;
+	};
+	descriptorWeights.resize(size_t(hidden)*128);
+	descriptorScale.resize(hidden);
+	frameWeights.resize(size_t(hidden)*numFrameInputs);
+	firstBias.resize(hidden);
+	for (int j = 0; j < hidden; j++) {
+		const float* W = &first.weights[size_t(j)*first.in];
+		double V[128] = {0};
+		double bias = first.bias[j];
+		for (int i = 0; i < first.in; i++)
+			bias -= W[i] * model.inputMean[i] * inverseStd(i);
+		for (int i = 0; i < P; i++) {
+			const double w = W[i] * inverseStd(i);
+			if (model.pcaDims > 0) {
+				for (int c = 0; c < 128; c++)
+					V[c] += w * model.pcaComponents[size_t(i)*128 + c];
+			} else {
+				V[i] = w;
+			}
+		}
+		if (model.pcaDims > 0)
+			for (int c = 0; c < 128; c++)
+				bias -= V[c] * model.pcaMean[c];
+		for (int k = 0; k < numFrameInputs; k++)
+			frameWeights[size_t(j)*numFrameInputs + k] = float(W[P + k] * inverseStd(P + k));
+
+		firstBias[j] = float(bias);
+		if (layers.empty()) {
+			// logistic regression: one row, kept in float
+			floatDescriptorWeights.assign(V, V + 128);
+			continue;
+		}
+
+		double largest = 0;
+		for (int c = 0; c < 128; c++)
+			largest = std::max(largest, std::abs(V[c]));
+		// 128 products of a byte and an int16 sum to at most 255*32767*128 < 2^31
+		const double scale = largest > 0 ? largest / 32767 : 1;
+		for (int c = 0; c < 128; c++)
+			descriptorWeights[size_t(j)*128 + c] = int16_t(std::lround(V[c] / scale));
+		descriptorScale[j] = float(scale);
+	}
+}
+
+namespace {
+
+//
+// Dot products of the descriptor bytes with every quantized row.
+//
+void descriptorDotProducts(const uint8_t* descriptor, const int16_t* weights, int rows, int32_t* dots) {
+#if defined(__AVX2__)
+	__m256i d[8];
+	for (int k = 0; k < 8; k++)
+		d[k] = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(descriptor + 16*k)));
+	for (int j = 0; j < rows; j++) {
+		const int16_t* w = weights + size_t(j)*128;
+		__m256i sum = _mm256_setzero_si256();
+		for (int k = 0; k < 8; k++) {
+			const __m256i wk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + 16*k));
+			sum = _mm256_add_epi32(sum, _mm256_madd_epi16(d[k], wk));
+		}
+		const __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+		const __m128i s2 = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+		const __m128i s3 = _mm_add_epi32(s2, _mm_shuffle_epi32(s2, _MM_SHUFFLE(2, 3, 0, 1)));
+		dots[j] = _mm_cvtsi128_si32(s3);
+	}
+#else
+	for (int j = 0; j < rows; j++) {
+		const int16_t* w = weights + size_t(j)*128;
+		int32_t sum = 0;
+		for (int c = 0; c < 128; c++)
+			sum += int32_t(descriptor[c]) * int32_t(w[c]);
+		dots[j] = sum;
+	}
+#endif
+}
+
+} // namespace
+
+float MatchabilityScorer::Score(const FeatureRow& row, int32_t* dots, float* activations, float* next) const {
+	float frame[numFrameInputs];
+	frameInputs(row, frame);
+
+	if (floatDescriptorWeights.empty()) {
+		descriptorDotProducts(row.descriptor, descriptorWeights.data(), hidden, dots);
+		for (int j = 0; j < hidden; j++)
+			activations[j] = descriptorScale[j] * float(dots[j]);
+	} else {
+		float sum = 0;
+		for (int c = 0; c < 128; c++)
+			sum += floatDescriptorWeights[c] * float(row.descriptor[c]);
+		activations[0] = sum;
+	}
+	for (int j = 0; j < hidden; j++) {
+		float h = activations[j] + firstBias[j];
+		for (int k = 0; k < numFrameInputs; k++)
+			h += frameWeights[size_t(j)*numFrameInputs + k] * frame[k];
+		activations[j] = h;
+	}
+
+	for (auto&& layer : layers) {
+		for (int i = 0; i < layer.in; i++)
+			activations[i] = std::max(activations[i], 0.0f);
+		for (int o = 0; o < layer.out; o++) {
+			const float* W = &layer.weights[size_t(o)*layer.in];
+			float sum = layer.bias[o];
+			for (int i = 0; i < layer.in; i++)
+				sum += W[i] * activations[i];
+			next[o] = sum;
+		}
+		std::swap(activations, next);
+	}
+	return 1.0f / (1.0f + std::exp(-activations[0]));
+}
+
+float MatchabilityScorer::Score(const FeatureRow& row) const {
+	float score;
+	Score(&row, 1, &score);
+	return score;
+}
+
+void MatchabilityScorer::Score(const FeatureRow* rows, size_t n, float* scores) const {
+	std::vector<int32_t> dots(hidden);
+	std::vector<float> activations(width), next(width);
+	for (size_t i = 0; i < n; i++)
+		scores[i] = Score(rows[i], dots.data(), activations.data(), next.data());
+}
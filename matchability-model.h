@@ -0,0 +1,113 @@
+#ifndef MATCHABILITY_MODEL_H
+#define MATCHABILITY_MODEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "feature-reader.h"
+
+//
+// Features of a keypoint's affine frame used next to its descriptor:
+// KX, KY, log scale, log anisotropy and the cosine and sine of its
+// orientation.
+//
+constexpr int numFrameInputs = 6;
+void frameInputs(const FeatureRow& row, float inputs[numFrameInputs]);
+
+//
+// PCA basis of the descriptors, as written by descriptor-PCA:
+// the mean descriptor and the principal components sorted by
+// decreasing eigenvalue.
+//
+struct DescriptorBasis {
+	std::vector<float> mean;         // 128
+	std::vector<float> components;   // 128 x 128, row k is the k-th component
+	std::vector<float> eigenvalues;  // 128
+
+	bool Read(const std::string& path);
+	bool Write(const std::string& path) const;
+};
+
+//
+// Matchability model: the probability that a keypoint gets matched,
+// from its descriptor (optionally projected onto the first pcaDims
+// principal components) and its frame inputs. The inputs are
+// standardized, then go through the layers; hidden layers use ReLU,
+// the single output a logistic sigmoid. A model without hidden layers
+// is logistic regression.
+//
+// The file format is little-endian binary:
+//
+//   char[4]  "FCMM"
+//   uint32   version (1)
+//   uint32   pcaDims (0 => raw descriptor)
+//   uint32   numLayers
+//   float    pcaMean[128], pcaComponents[pcaDims][128]   if pcaDims > 0
+//   float    inputMean[D], inputStd[D]    D = (pcaDims or 128) + numFrameInputs
+//   per layer: uint32 in, uint32 out, float weights[out][in], float bias[out]
+//
+struct MatchabilityModel {
+	struct Layer {
+		int in = 0, out = 0;
+		std::vector<float> weights;   // out x in, row-major
+		std::vector<float> bias;      // out
+	};
+
+	int pcaDims = 0;
+	std::vector<float> pcaMean;
+	std::vector<float> pcaComponents;
+	std::vector<float> inputMean;
+	std::vector<float> inputStd;
+	std::vector<Layer> layers;
+
+	int NumInputs() const { return (pcaDims > 0 ? pcaDims : 128) + numFrameInputs; }
+
+	// Descriptor (projected if pcaDims > 0) and frame inputs, not standardized.
+	void Inputs(const FeatureRow& row, float* inputs) const;
+
+	// Probability computed in float exactly as trained; the reference
+	// for MatchabilityScorer, which should be used for scoring.
+	float Predict(const FeatureRow& row) const;
+
+	bool Read(const std::string& path);
+	bool Write(const std::string& path) const;
+};
+
+//
+// Fast inference for a MatchabilityModel. The PCA projection and the
+// input standardization are folded into the first layer. With hidden
+// layers its descriptor weights are quantized to int16 (per output row)
+// and applied to the raw descriptor bytes with an integer (AVX2 when
+// available) kernel; the remaining layers, and logistic regression,
+// run in float.
+//
+// Rounding moves each weight of hidden unit j by at most half its step
+// max_c |V_jc| / 32767, so the unit's input differs from the float
+// model's by at most that half step times the sum of the descriptor
+// bytes (<= 128*255). On test data the probabilities differed from
+// Predict by up to 4e-5 with PCA inputs and 5e-4 with raw descriptors,
+// against 4e-2 with int8; train-matchability reports the largest
+// difference on its training rows.
+//
+class MatchabilityScorer {
+public:
+	explicit MatchabilityScorer(const MatchabilityModel& model);
+
+	float Score(const FeatureRow& row) const;
+	void Score(const FeatureRow* rows, size_t n, float* scores) const;
+
+private:
+	float Score(const FeatureRow& row, int32_t* dots, float* activations, float* next) const;
+
+	int hidden;                       // outputs of the first layer
+	int width;                        // outputs of the widest layer
+	std::vector<int16_t> descriptorWeights;  // hidden x 128, quantized
+	std::vector<float> descriptorScale;      // hidden
+	std::vector<float> floatDescriptorWeights;   // 128, instead for logistic regression
+	std::vector<float> frameWeights;         // hidden x numFrameInputs
+	std::vector<float> firstBias;            // hidden
+	std::vector<MatchabilityModel::Layer> layers;   // the layers after the first
+};
+
+#endif // MATCHABILITY_MODEL_H
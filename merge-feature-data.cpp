@@ -0,0 +1,152 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <unistd.h>
+#include "instrumentation.h"
+
+//
+// Merges the partial CSVs of partitioned feature-data runs (-r / -p)
+// into the CSV a single run would have written. Each partial's
+// PARTIAL.csv.images sidecar gives the global N offset and keypoint
+// count of its images and the total N of the full run; the images are
+// put back in N order, checked to cover 0..N-1 without gaps or
+// overlaps, and their rows copied (and their N checked) from the
+// partials.
+//
+int main(int argc, char *argv[]) {
+    auto usage = [&]() {
+        std::cerr << "usage: " << argv[0] << " [-t trace.json] merged.csv partial.csv...\n";
+        exit(-1);
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        switch (opt) {
+        case 't': enableTrace(optarg); break;
+        default: usage();
+        }
+    }
+    if (argc - optind < 2)
+        usage();
+
+    const std::string mergedCSV(argv[optind]);
+    const std::vector<std::string> partialCSVs(argv + optind + 1, argv + argc);
+
+    struct ImageRows {
+        size_t partial;
+        unsigned long long imageId, offset, keypoints, withMatches, withInlierMatches, with3DPoints;
+    };
+    std::vector<ImageRows> images;
+    unsigned long long totalKeypoints = 0;
+    size_t totalPartial = 0;
+    {
+        TraceStage stage("sidecar read");
+        for (size_t p = 0; p < partialCSVs.size(); p++) {
+            const std::string imagesCSV = partialCSVs[p] + ".images";
+            std::ifstream is(imagesCSV);
+            if (!is.is_open()) {
+                std::cerr << "Unable to open '" << imagesCSV << "' (was '" << partialCSVs[p]
+                          << "' written by a partitioned feature-data run?)\n";
+                exit(-1);
+            }
+            std::string line;
+            while (std::getline(is, line)) {
+                ImageRows image;
+                image.partial = p;
+                unsigned long long total;
+                if (std::sscanf(line.c_str(), "%llu,%llu,%llu,%llu,%llu,%llu,%llu", &image.imageId, &image.offset,
+                                &image.keypoints, &image.withMatches, &image.withInlierMatches,
+                                &image.with3DPoints, &total) != 7)
+                    continue;   // header
+                if (images.empty()) {
+                    totalKeypoints = total;
+                    totalPartial = p;
+                } else if (total != totalKeypoints) {
+                    std::cerr << "'" << partialCSVs[p] << "' is from a run with " << total << " features but '"
+                              << partialCSVs[totalPartial] << "' from one with " << totalKeypoints
+                              << " (were they written from the same database?)\n";
+                    exit(-1);
+                }
+                images.push_back(image);
+            }
+        }
+        stage.AddRows(images.size());
+    }
+
+    std::sort(images.begin(), images.end(), [](const ImageRows& a, const ImageRows& b) {
+        return a.offset < b.offset || (a.offset == b.offset && a.keypoints < b.keypoints);
+    });
+    unsigned long long expected = 0;
+    for (auto&& image : images) {
+        if (image.offset != expected) {
+            std::cerr << "Image " << image.imageId << " in '" << partialCSVs[image.partial] << "' starts at N="
+                      << image.offset << " but N=" << expected
+                      << (image.offset > expected ? " is missing (is a partition missing?)\n"
+                                                  : " is already covered (do partitions overlap?)\n");
+            exit(-1);
+        }
+        expected += image.keypoints;
+    }
+    if (expected != totalKeypoints) {
+        std::cerr << "The partials cover the first " << expected << " of " << totalKeypoints
+                  << " features (is a partition missing?)\n";
+        exit(-1);
+    }
+
+    std::vector<std::unique_ptr<std::ifstream>> partials;
+    for (auto&& path : partialCSVs) {
+        partials.emplace_back(new std::ifstream(path));
+        if (!partials.back()->is_open()) {
+            std::cerr << "Unable to open '" << path << "'\n";
+            exit(-1);
+        }
+    }
+    std::ofstream csv(mergedCSV);
+    if (!csv.is_open()) {
+        std::cerr << "Unable to open '" << mergedCSV << "' for writing!\n";
+        exit(-1);
+    }
+
+    TraceStage csvStage("CSV merge");
+    csv << "N,IMGNAME,IMGID,I,KX,KY,A11,A12,A21,A22,MATCHES,INLIERS,HASPT3D,DESC\n";
+    std::string line;
+    unsigned long long n = 0, featuresWithMatches = 0, featuresWithInlierMatches = 0, featuresWith3DPoints = 0;
+    for (auto&& image : images) {
+        std::ifstream& is = *partials[image.partial];
+        for (unsigned long long i = 0; i < image.keypoints; ) {
+            if (!std::getline(is, line)) {
+                std::cerr << "'" << partialCSVs[image.partial] << "' ends before N=" << n << "\n";
+                exit(-1);
+            }
+            if (line.empty() || line.compare(0, 2, "N,") == 0) continue;
+            if (std::strtoull(line.c_str(), nullptr, 10) != n) {
+                std::cerr << "Expected N=" << n << " in '" << partialCSVs[image.partial] << "', found '"
+                          << line.substr(0, line.find(',')) << "'\n";
+                exit(-1);
+            }
+            csv << line << "\n";
+            n++;
+            i++;
+        }
+        featuresWithMatches += image.withMatches;
+        featuresWithInlierMatches += image.withInlierMatches;
+        featuresWith3DPoints += image.with3DPoints;
+        traceCounter("rows", image.keypoints);
+    }
+    csvStage.AddRows(n);
+    csvStage.AddBytes(size_t(csv.tellp()));
+    csv.close();
+
+    std::cout << "images ......................." << images.size() << "\n"
+              << "total features ..............." << n << "\n"
+              << "features w matches............" << featuresWithMatches << "\n"
+              << "features w inliear matches...." << featuresWithInlierMatches << "\n"
+              << "features w 3D Points.........." << featuresWith3DPoints << "\n";
+
+    return 0;
+}
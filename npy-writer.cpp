@@ -0,0 +1,49 @@
+#include "npy-writer.h"
+#include <cassert>
+#include <cstring>
+
+namespace {
+
+// Magic, version, header length and header dict: 128 bytes leave room
+// for any shape and keep the data 64 byte aligned, as NumPy recommends.
+constexpr size_t headerSize = 128;
+
+} // namespace
+
+NpyWriter::NpyWriter(const std::string& path, const std::string& dtype, size_t columns)
+	: os(path, std::ios::binary), dtype(dtype), columns(columns) {
+	if (os.is_open())
+		os << header();
+}
+
+NpyWriter::~NpyWriter() {
+	if (os.is_open())
+		Close();
+}
+
+std::string NpyWriter::header() const {
+	std::string dict = "{'descr': '" + dtype + "', 'fortran_order': False, 'shape': ("
+		+ std::to_string(rows) + ", " + std::to_string(columns) + "), }";
+	const size_t preamble = 10;   // magic, version, header length
+	dict.resize(headerSize - preamble - 1, ' ');
+	dict += '\n';
+	const uint16_t length = uint16_t(dict.size());
+	std::string header("\x93NUMPY\x01\x00", 8);
+	header += char(length & 0xff);
+	header += char(length >> 8);
+	return header + dict;
+}
+
+void NpyWriter::append(const void* values, size_t n, size_t itemSize, const char* valueType) {
+	assert(dtype == valueType);
+	(void)valueType;
+	os.write(static_cast<const char*>(values), std::streamsize(n * columns * itemSize));
+	rows += n;
+}
+
+bool NpyWriter::Close() {
+	os.seekp(0);
+	os << header();
+	os.close();
+	return !os.fail();
+}
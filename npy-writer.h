@@ -0,0 +1,44 @@
+#ifndef NPY_WRITER_H
+#define NPY_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+//
+// Streams a 2D NumPy .npy array (C order) of rows of columns values to a
+// file. The number of rows is not known up front: a fixed size header
+// is written first and rewritten with the final shape by Close(), so
+// the rows go straight to the file and the result can be opened with
+// np.load(path, mmap_mode='r').
+//
+class NpyWriter {
+public:
+	// dtype is a NumPy type string such as "<u1", "<i4" or "<f4".
+	NpyWriter(const std::string& path, const std::string& dtype, size_t columns);
+	~NpyWriter();
+
+	bool IsOpen() const { return os.is_open(); }
+
+	void Append(const uint8_t* values, size_t rows) { append(values, rows, 1, "<u1"); }
+	void Append(const int32_t* values, size_t rows) { append(values, rows, 4, "<i4"); }
+	void Append(const int64_t* values, size_t rows) { append(values, rows, 8, "<i8"); }
+	void Append(const float* values, size_t rows) { append(values, rows, 4, "<f4"); }
+
+	size_t Rows() const { return rows; }
+
+	// Writes the final header; false if anything failed to write.
+	bool Close();
+
+private:
+	void append(const void* values, size_t n, size_t itemSize, const char* valueType);
+	std::string header() const;
+
+	std::ofstream os;
+	std::string dtype;
+	size_t columns;
+	size_t rows = 0;
+};
+
+#endif // NPY_WRITER_H
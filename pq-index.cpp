@@ -0,0 +1,376 @@
+#include "pq-index.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+inline float squaredDistance(const float* a, const float* b, int d) {
+	float sum = 0;
+	for (int k = 0; k < d; k++) {
+		const float e = a[k] - b[k];
+		sum += e * e;
+	}
+	return sum;
+}
+
+int nearestCentroid(const float* x, const float* centroids, int k, int d) {
+	int best = 0;
+	float bestDistance = std::numeric_limits<float>::max();
+	for (int c = 0; c < k; c++) {
+		const float distance = squaredDistance(x, centroids + size_t(c)*d, d);
+		if (distance < bestDistance) {
+			bestDistance = distance;
+			best = c;
+		}
+	}
+	return best;
+}
+
+//
+// Lloyd's k-means on n points of x (stride values apart, d dimensions),
+// starting from k distinct random points. The assignment step runs in
+// parallel with per-thread sums; empty clusters are reseeded with a
+// random point.
+//
+void kmeans(const float* x, size_t n, size_t stride, int d, int k, int iterations,
+            size_t numThreads, unsigned seed, float* centroids) {
+	std::mt19937 rng(seed);
+	std::vector<size_t> order(n);
+	std::iota(order.begin(), order.end(), 0);
+	std::shuffle(order.begin(), order.end(), rng);
+	for (int c = 0; c < k; c++)
+		std::copy(x + order[c % n]*stride, x + order[c % n]*stride + d, centroids + size_t(c)*d);
+
+	struct Sums {
+		std::vector<double> sum;
+		std::vector<size_t> count;
+	};
+	std::vector<Sums> threadSums(numThreads);
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		auto work = [&](size_t t) {
+			Sums& sums = threadSums[t];
+			sums.sum.assign(size_t(k)*d, 0.0);
+			sums.count.assign(k, 0);
+			for (size_t i = n * t / numThreads; i < n * (t + 1) / numThreads; i++) {
+				const float* p = x + i*stride;
+				const int c = nearestCentroid(p, centroids, k, d);
+				for (int j = 0; j < d; j++)
+					sums.sum[size_t(c)*d + j] += p[j];
+				sums.count[c]++;
+			}
+		};
+		std::vector<std::thread> threads;
+		for (size_t t = 1; t < numThreads; t++)
+			threads.emplace_back(work, t);
+		work(0);
+		for (auto&& thread : threads)
+			thread.join();
+
+		std::uniform_int_distribution<size_t> random(0, n - 1);
+		for (int c = 0; c < k; c++) {
+			size_t count = 0;
+			for (auto&& sums : threadSums)
+				count += sums.count[c];
+			float* centroid = centroids + size_t(c)*d;
+			if (count == 0) {
+				const float* p = x + random(rng)*stride;
+				std::copy(p, p + d, centroid);
+				continue;
+			}
+			for (int j = 0; j < d; j++) {
+				double sum = 0;
+				for (auto&& sums : threadSums)
+					sum += sums.sum[size_t(c)*d + j];
+				centroid[j] = float(sum / count);
+			}
+		}
+	}
+}
+
+constexpr uint32_t paddingId = UINT32_MAX;
+
+size_t align64(size_t offset) {
+	return (offset + 63) & ~size_t(63);
+}
+
+struct Header {
+	char magic[4];
+	uint32_t version;
+	uint32_t dims, numLists, numSubspaces, reserved;
+	uint64_t numVectors;
+};
+
+//
+// Section offsets of an index file, shared by the writer and the reader.
+//
+struct Layout {
+	size_t pcaMean, pcaComponents, coarse, codebooks, listOffsets, ids, codes, size;
+
+	Layout(const PQQuantizer& q, uint64_t paddedVectors) {
+		pcaMean = align64(sizeof(Header));
+		pcaComponents = align64(pcaMean + 128*sizeof(float));
+		coarse = align64(pcaComponents + size_t(q.dims)*128*sizeof(float));
+		codebooks = align64(coarse + size_t(q.numLists)*q.dims*sizeof(float));
+		listOffsets = align64(codebooks + size_t(q.numSubspaces)*256*q.SubDims()*sizeof(float));
+		ids = align64(listOffsets + (size_t(q.numLists) + 1)*sizeof(uint64_t));
+		codes = align64(ids + paddedVectors*sizeof(uint32_t));
+		size = codes + paddedVectors*q.numSubspaces;
+	}
+};
+
+} // namespace
+
+void PQQuantizer::Project(const uint8_t* descriptor, float* x) const {
+	float centered[128];
+	for (int c = 0; c < 128; c++)
+		centered[c] = descriptor[c] - pcaMean[c];
+	for (int k = 0; k < dims; k++) {
+		const float* component = &pcaComponents[size_t(k)*128];
+		float sum = 0;
+		for (int c = 0; c < 128; c++)
+			sum += component[c] * centered[c];
+		x[k] = sum;
+	}
+}
+
+int PQQuantizer::Assign(const float* x) const {
+	return nearestCentroid(x, coarse.data(), numLists, dims);
+}
+
+void PQQuantizer::Encode(const float* x, int list, uint8_t* code) const {
+	const int subDims = SubDims();
+	const float* centroid = &coarse[size_t(list)*dims];
+	float residual[128];
+	for (int k = 0; k < dims; k++)
+		residual[k] = x[k] - centroid[k];
+	for (int m = 0; m < numSubspaces; m++)
+		code[m] = uint8_t(nearestCentroid(residual + m*subDims, &codebooks[size_t(m)*256*subDims], 256, subDims));
+}
+
+void trainPQQuantizer(PQQuantizer& q, const float* samples, size_t n,
+                      int iterations, size_t numThreads) {
+	const int subDims = q.SubDims();
+	q.coarse.resize(size_t(q.numLists)*q.dims);
+	kmeans(samples, n, q.dims, q.dims, q.numLists, iterations, numThreads, 1, q.coarse.data());
+
+	std::vector<float> residuals(n*q.dims);
+	for (size_t i = 0; i < n; i++) {
+		const float* x = samples + i*q.dims;
+		const float* centroid = &q.coarse[size_t(q.Assign(x))*q.dims];
+		for (int k = 0; k < q.dims; k++)
+			residuals[i*q.dims + k] = x[k] - centroid[k];
+	}
+	q.codebooks.resize(size_t(q.numSubspaces)*256*subDims);
+	for (int m = 0; m < q.numSubspaces; m++)
+		kmeans(residuals.data() + m*subDims, n, q.dims, subDims, 256, iterations, numThreads, 2 + m,
+		       &q.codebooks[size_t(m)*256*subDims]);
+}
+
+bool writePQIndex(const std::string& path, const PQQuantizer& q,
+                  const std::vector<std::vector<uint32_t>>& ids,
+                  const std::vector<std::vector<uint8_t>>& codes) {
+	const int M = q.numSubspaces;
+	std::vector<uint64_t> listOffsets(q.numLists + 1, 0);
+	uint64_t numVectors = 0;
+	for (int l = 0; l < q.numLists; l++) {
+		numVectors += ids[l].size();
+		listOffsets[l+1] = listOffsets[l] + (ids[l].size() + 7) / 8 * 8;
+	}
+	const Layout layout(q, listOffsets.back());
+
+	std::ofstream os(path, std::ios::binary);
+	if (!os.is_open()) return false;
+	auto seek = [&](size_t offset) {
+		static const char zeros[64] = {};
+		os.write(zeros, offset - size_t(os.tellp()));
+	};
+	Header header = {{'F','C','P','Q'}, 1, uint32_t(q.dims), uint32_t(q.numLists), uint32_t(M), 0, numVectors};
+	os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	seek(layout.pcaMean);
+	os.write(reinterpret_cast<const char*>(q.pcaMean.data()), 128*sizeof(float));
+	seek(layout.pcaComponents);
+	os.write(reinterpret_cast<const char*>(q.pcaComponents.data()), size_t(q.dims)*128*sizeof(float));
+	seek(layout.coarse);
+	os.write(reinterpret_cast<const char*>(q.coarse.data()), q.coarse.size()*sizeof(float));
+	seek(layout.codebooks);
+	os.write(reinterpret_cast<const char*>(q.codebooks.data()), q.codebooks.size()*sizeof(float));
+	seek(layout.listOffsets);
+	os.write(reinterpret_cast<const char*>(listOffsets.data()), listOffsets.size()*sizeof(uint64_t));
+	seek(layout.ids);
+	for (int l = 0; l < q.numLists; l++) {
+		os.write(reinterpret_cast<const char*>(ids[l].data()), ids[l].size()*sizeof(uint32_t));
+		for (size_t i = ids[l].size(); i < listOffsets[l+1] - listOffsets[l]; i++)
+			os.write(reinterpret_cast<const char*>(&paddingId), sizeof(uint32_t));
+	}
+	seek(layout.codes);
+	std::vector<uint8_t> block(8*M);
+	for (int l = 0; l < q.numLists; l++) {
+		const size_t n = ids[l].size();
+		for (size_t b = 0; b < n; b += 8) {
+			std::fill(block.begin(), block.end(), 0);
+			for (size_t v = 0; v < 8 && b + v < n; v++)
+				for (int m = 0; m < M; m++)
+					block[m*8 + v] = codes[l][(b + v)*M + m];
+			os.write(reinterpret_cast<const char*>(block.data()), block.size());
+		}
+	}
+	return bool(os);
+}
+
+PQIndex::~PQIndex() {
+	if (mapping)
+		munmap(mapping, mappingSize);
+}
+
+bool PQIndex::Open(const std::string& path) {
+	const int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+		close(fd);
+		return false;
+	}
+	mappingSize = size_t(st.st_size);
+	mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		mapping = nullptr;
+		return false;
+	}
+	const char* base = static_cast<const char*>(mapping);
+	Header header;
+	std::memcpy(&header, base, sizeof(header));
+	if (std::memcmp(header.magic, "FCPQ", 4) != 0 || header.version != 1 ||
+		header.dims == 0 || header.dims > 128 || header.numSubspaces == 0 ||
+		header.dims % header.numSubspaces != 0 || header.numLists == 0)
+		return false;
+	quantizer.dims = int(header.dims);
+	quantizer.numLists = int(header.numLists);
+	quantizer.numSubspaces = int(header.numSubspaces);
+	numVectors = header.numVectors;
+
+	// the list offsets give the padded size, which the layout needs to be checked
+	const Layout unpadded(quantizer, 0);
+	if (mappingSize < unpadded.size)
+		return false;
+	listOffsets = reinterpret_cast<const uint64_t*>(base + unpadded.listOffsets);
+	// the lists are scanned in blocks of 8 up to the last offset
+	if (listOffsets[0] != 0)
+		return false;
+	for (int l = 0; l < quantizer.numLists; l++)
+		if (listOffsets[l+1] < listOffsets[l] || listOffsets[l+1] % 8 != 0)
+			return false;
+	const uint64_t padded = listOffsets[quantizer.numLists];
+	if (padded > mappingSize || numVectors > padded)
+		return false;
+	const Layout layout(quantizer, padded);
+	if (mappingSize < layout.size)
+		return false;
+
+	auto floats = [&](size_t offset, size_t n) {
+		const float* p = reinterpret_cast<const float*>(base + offset);
+		return std::vector<float>(p, p + n);
+	};
+	quantizer.pcaMean = floats(layout.pcaMean, 128);
+	quantizer.pcaComponents = floats(layout.pcaComponents, size_t(quantizer.dims)*128);
+	quantizer.coarse = floats(layout.coarse, size_t(quantizer.numLists)*quantizer.dims);
+	quantizer.codebooks = floats(layout.codebooks, size_t(quantizer.numSubspaces)*256*quantizer.SubDims());
+	ids = reinterpret_cast<const uint32_t*>(base + layout.ids);
+	codes = reinterpret_cast<const uint8_t*>(base + layout.codes);
+	return true;
+}
+
+namespace {
+
+//
+// Counts the vectors of blocks [b0,b1) (8 vectors each) within
+// radius2 of the query, and lowers nearest2 to their nearest squared
+// distance, skipping the query's own id and the padding.
+//
+void scanBlocks(const uint8_t* codes, const uint32_t* ids, size_t b0, size_t b1, int M,
+                const float* table, uint32_t self, float radius2, uint32_t& count, float& nearest2) {
+#if defined(__AVX2__)
+	const __m256i selfIds = _mm256_set1_epi32(int(self));
+	const __m256i padding = _mm256_set1_epi32(int(paddingId));
+	const __m256 radius = _mm256_set1_ps(radius2);
+	const __m256 infinity = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+	__m256 nearest = _mm256_set1_ps(nearest2);
+	for (size_t b = b0; b < b1; b++) {
+		const uint8_t* block = codes + b*8*M;
+		__m256 sum = _mm256_setzero_ps();
+		for (int m = 0; m < M; m++) {
+			const __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(block + m*8)));
+			sum = _mm256_add_ps(sum, _mm256_i32gather_ps(table + m*256, index, 4));
+		}
+		const __m256i blockIds = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ids + b*8));
+		const __m256 excluded = _mm256_castsi256_ps(_mm256_or_si256(
+			_mm256_cmpeq_epi32(blockIds, selfIds), _mm256_cmpeq_epi32(blockIds, padding)));
+		sum = _mm256_blendv_ps(sum, infinity, excluded);
+		count += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(sum, radius, _CMP_LT_OQ)));
+		nearest = _mm256_min_ps(nearest, sum);
+	}
+	alignas(32) float lanes[8];
+	_mm256_store_ps(lanes, nearest);
+	nearest2 = *std::min_element(lanes, lanes + 8);
+#else
+	for (size_t b = b0; b < b1; b++) {
+		const uint8_t* block = codes + b*8*M;
+		for (int v = 0; v < 8; v++) {
+			const uint32_t id = ids[b*8 + v];
+			if (id == self || id == paddingId) continue;
+			float sum = 0;
+			for (int m = 0; m < M; m++)
+				sum += table[m*256 + block[m*8 + v]];
+			if (sum < radius2) count++;
+			nearest2 = std::min(nearest2, sum);
+		}
+	}
+#endif
+}
+
+} // namespace
+
+void PQIndex::Neighbors(const uint8_t* descriptors, const uint32_t* selfIds, size_t n,
+                        float radius, int probes, PQNeighbors* neighbors) const {
+	const PQQuantizer& q = quantizer;
+	const int M = q.numSubspaces, subDims = q.SubDims();
+	probes = std::max(1, std::min(probes, q.numLists));
+	std::vector<float> x(q.dims), residual(q.dims), table(size_t(M)*256);
+	std::vector<std::pair<float,int>> lists(q.numLists);
+	for (size_t i = 0; i < n; i++) {
+		q.Project(descriptors + i*128, x.data());
+		for (int l = 0; l < q.numLists; l++)
+			lists[l] = {squaredDistance(x.data(), &q.coarse[size_t(l)*q.dims], q.dims), l};
+		std::partial_sort(lists.begin(), lists.begin() + probes, lists.end());
+
+		uint32_t count = 0;
+		float nearest2 = std::numeric_limits<float>::infinity();
+		for (int p = 0; p < probes; p++) {
+			const int l = lists[p].second;
+			const float* centroid = &q.coarse[size_t(l)*q.dims];
+			for (int k = 0; k < q.dims; k++)
+				residual[k] = x[k] - centroid[k];
+			for (int m = 0; m < M; m++)
+				for (int c = 0; c < 256; c++)
+					table[m*256 + c] = squaredDistance(residual.data() + m*subDims,
+					                                   &q.codebooks[(size_t(m)*256 + c)*subDims], subDims);
+			scanBlocks(codes, ids, listOffsets[l] / 8, listOffsets[l+1] / 8, M, table.data(),
+			           selfIds[i], radius * radius, count, nearest2);
+		}
+		neighbors[i].count = count;
+		neighbors[i].nearest = std::sqrt(nearest2);
+	}
+}
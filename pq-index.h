@@ -0,0 +1,108 @@
+#ifndef PQ_INDEX_H
+#define PQ_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//
+// Inverted file product quantizer (IVF-PQ) over PCA reduced descriptors.
+// A descriptor is projected onto the first dims principal components,
+// assigned to its nearest coarse centroid (its list), and the residual
+// to that centroid is split into numSubspaces subvectors, each encoded
+// as the index of its nearest of 256 codebook centroids -- a code of
+// numSubspaces bytes per descriptor.
+//
+struct PQQuantizer {
+	int dims = 0;
+	int numLists = 0;
+	int numSubspaces = 0;
+	std::vector<float> pcaMean;         // 128
+	std::vector<float> pcaComponents;   // dims x 128
+	std::vector<float> coarse;          // numLists x dims
+	std::vector<float> codebooks;       // numSubspaces x 256 x SubDims()
+
+	int SubDims() const { return dims / numSubspaces; }
+
+	void Project(const uint8_t* descriptor, float* x) const;
+	int Assign(const float* x) const;
+	void Encode(const float* x, int list, uint8_t* code) const;
+};
+
+//
+// Trains the coarse centroids and the codebooks with k-means on n
+// projected samples (n x dims).
+//
+void trainPQQuantizer(PQQuantizer& quantizer, const float* samples, size_t n,
+                      int iterations, size_t numThreads);
+
+//
+// Writes an index file. ids[list] and codes[list] are the ids and codes
+// (numSubspaces bytes each, consecutive) of the descriptors in each list.
+//
+// The file is laid out to be memory mapped and scanned in place; every
+// section starts on a 64 byte boundary:
+//
+//   char[4]  "FCPQ"
+//   uint32   version (1)
+//   uint32   dims, numLists, numSubspaces, 0
+//   uint64   numVectors
+//   float    pcaMean[128], pcaComponents[dims][128]
+//   float    coarse[numLists][dims]
+//   float    codebooks[numSubspaces][256][dims/numSubspaces]
+//   uint64   listOffsets[numLists+1]   lists padded to multiples of 8
+//   uint32   ids[listOffsets[numLists]]   padding ids are UINT32_MAX
+//   uint8    codes[listOffsets[numLists]/8][numSubspaces][8]
+//
+// Codes are stored in blocks of 8 descriptors, transposed so that the
+// 8 codes of a subspace are contiguous for the SIMD distance scan.
+//
+bool writePQIndex(const std::string& path, const PQQuantizer& quantizer,
+                  const std::vector<std::vector<uint32_t>>& ids,
+                  const std::vector<std::vector<uint8_t>>& codes);
+
+//
+// Neighbour statistics of a query: the number of indexed descriptors
+// within the radius and the distance to the nearest one (both excluding
+// the query's own id).
+//
+struct PQNeighbors {
+	uint32_t count = 0;
+	float nearest = 0;
+};
+
+//
+// A memory mapped index file. Queries compute, for each of the nearest
+// probes lists, a table of the squared distances of the query residual's
+// subvectors to every codebook centroid, and then scan the list's codes
+// summing table entries (asymmetric distance computation, with AVX2
+// gathers when available).
+//
+class PQIndex {
+public:
+	PQIndex() = default;
+	PQIndex(const PQIndex&) = delete;
+	PQIndex& operator=(const PQIndex&) = delete;
+	~PQIndex();
+
+	bool Open(const std::string& path);
+
+	const PQQuantizer& Quantizer() const { return quantizer; }
+	uint64_t NumVectors() const { return numVectors; }
+
+	// Neighbours of n descriptors (n x 128 bytes) with ids selfIds.
+	void Neighbors(const uint8_t* descriptors, const uint32_t* selfIds, size_t n,
+	               float radius, int probes, PQNeighbors* neighbors) const;
+
+private:
+	void *mapping = nullptr;
+	size_t mappingSize = 0;
+	PQQuantizer quantizer;
+	uint64_t numVectors = 0;
+	const uint64_t* listOffsets = nullptr;
+	const uint32_t* ids = nullptr;
+	const uint8_t* codes = nullptr;
+};
+
+#endif // PQ_INDEX_H
@@ -0,0 +1,141 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <unistd.h>
+#include "feature-reader.h"
+#include "pq-index.h"
+#include "instrumentation.h"
+
+//
+// For every feature of a features CSV, counts the indexed descriptors
+// (from build-pq-index) within a radius of its descriptor in the PCA
+// space, and the distance to the nearest one, excluding the feature
+// itself. Writes N,NEIGHBORS,NEAREST rows. The index is memory mapped
+// and queries run in parallel in blocks of rows, written in order.
+//
+int main(int argc, char *argv[]) {
+    size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t blockRows = 1 << 14;
+    float radius = 200;
+    int probes = 8;
+
+    auto usage = [&]() {
+        std::cerr << "usage: " << argv[0] << " [-j threads] [-b block-rows] [-r radius] [-p probes] "
+                  << "[-t trace.json] index.bin features.csv neighbors.csv\n";
+        exit(-1);
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:b:r:p:t:")) != -1) {
+        switch (opt) {
+        case 'j': numThreads = std::max(1, std::atoi(optarg)); break;
+        case 'b': blockRows = std::max(1, std::atoi(optarg)); break;
+        case 'r': radius = float(std::atof(optarg)); break;
+        case 'p': probes = std::max(1, std::atoi(optarg)); break;
+        case 't': enableTrace(optarg); break;
+        default: usage();
+        }
+    }
+    if (argc - optind != 3)
+        usage();
+
+    const std::string indexPath(argv[optind]);
+    const std::string featuresCSV(argv[optind+1]);
+    const std::string neighborsCSV(argv[optind+2]);
+
+    PQIndex index;
+    if (!index.Open(indexPath)) {
+        std::cerr << "Unable to open index '" << indexPath << "'\n";
+        exit(-1);
+    }
+    std::cout << index.NumVectors() << " indexed descriptors, "
+              << index.Quantizer().numLists << " lists, "
+              << index.Quantizer().numSubspaces << " byte codes\n";
+
+    FeatureReader reader(featuresCSV);
+    if (!reader.IsOpen()) {
+        std::cerr << "Unable to open '" << featuresCSV << "'\n";
+        exit(-1);
+    }
+    std::ofstream csv(neighborsCSV);
+    if (!csv.is_open()) {
+        std::cerr << "Unable to open '" << neighborsCSV << "' for writing!\n";
+        exit(-1);
+    }
+    csv << "N,NEIGHBORS,NEAREST\n";
+
+    FeatureBlock block;
+    std::vector<FeatureRow> rows;
+    std::vector<std::string> output(numThreads);
+    std::vector<size_t> malformed(numThreads);
+    size_t total = 0;
+
+    while (true) {
+        size_t n;
+        {
+            TraceStage stage("read");
+            n = reader.ReadBlock(block, blockRows);
+            stage.AddRows(n);
+        }
+        if (n == 0) break;
+        rows.resize(n);
+
+        TraceStage stage("query");
+        stage.AddRows(n);
+        auto work = [&](size_t t) {
+            const size_t begin = n * t / numThreads;
+            const size_t end = n * (t + 1) / numThreads;
+            size_t m = 0;   // well-formed rows, compacted to the front of [begin,end)
+            for (size_t i = begin; i < end; i++)
+                if (parseFeatureRow(block.LineBegin(i), block.LineEnd(i), rows[begin + m]))
+                    m++;
+            malformed[t] += (end - begin) - m;
+
+            std::vector<uint8_t> descriptors(m * 128);
+            std::vector<uint32_t> selfIds(m);
+            std::vector<PQNeighbors> neighbors(m);
+            for (size_t i = 0; i < m; i++) {
+                const FeatureRow& row = rows[begin + i];
+                std::copy(row.descriptor, row.descriptor + 128, descriptors.data() + i*128);
+                selfIds[i] = uint32_t(row.num);
+            }
+            index.Neighbors(descriptors.data(), selfIds.data(), m, radius, probes, neighbors.data());
+
+            std::string& text = output[t];
+            text.clear();
+            char line[64];
+            for (size_t i = 0; i < m; i++) {
+                const int length = std::snprintf(line, sizeof(line), "%lld,%u,%.2f\n",
+                                                 (long long)rows[begin + i].num, neighbors[i].count,
+                                                 neighbors[i].nearest);
+                text.append(line, length);
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < numThreads; t++)
+            threads.emplace_back(work, t);
+        work(0);
+        for (auto&& thread : threads)
+            thread.join();
+
+        for (auto&& text : output)
+            csv << text;
+        total += n;
+        traceCounter("rows", n);
+        std::cout << "\r" << total << " features queried" << std::flush;
+    }
+    std::cout << "\n";
+
+    size_t numMalformed = 0;
+    for (size_t m : malformed)
+        numMalformed += m;
+    if (numMalformed > 0)
+        std::cerr << "warning: " << numMalformed << " malformed rows skipped\n";
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Loads items 0..count-1 on a pool of worker threads and hands them
+// to a single consumer in order. At most maxInFlight items are loaded
+// but not yet consumed at any time, which bounds memory use when the
+// items are large (e.g. decoded images).
+//
+template <class T>
+class Prefetcher {
+public:
+	Prefetcher(size_t count,
+			   std::function<T(size_t)> load,
+			   size_t numThreads,
+			   size_t maxInFlight)
+		: count(count), load(std::move(load)),
+		  maxInFlight(std::max<size_t>(1, maxInFlight)),
+		  items(count), ready(count, false) {
+		numThreads = std::max<size_t>(1, std::min(numThreads, count));
+		for (size_t t = 0; t < numThreads; t++)
+			workers.emplace_back([this]() { work(); });
+	}
+
+	~Prefetcher() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		claimable.notify_all();
+		for (auto&& worker : workers)
+			worker.join();
+	}
+
+	Prefetcher(const Prefetcher&) = delete;
+	Prefetcher& operator=(const Prefetcher&) = delete;
+
+	// Blocks until the next item in order is loaded and returns it.
+	T Next() {
+		std::unique_lock<std::mutex> lock(mutex);
+		const size_t i = consumed;
+		loaded.wait(lock, [&]() { return ready[i]; });
+		T item = std::move(items[i]);
+		items[i] = T();
+		consumed++;
+		lock.unlock();
+		claimable.notify_all();
+		return item;
+	}
+
+	size_t Count() const { return count; }
+
+private:
+	void work() {
+		for (;;) {
+			size_t i;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				claimable.wait(lock, [&]() {
+					return stopping || claimed >= count || claimed < consumed + maxInFlight;
+				});
+				if (stopping || claimed >= count) return;
+				i = claimed++;
+			}
+			T item = load(i);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				items[i] = std::move(item);
+				ready[i] = true;
+			}
+			loaded.notify_all();
+		}
+	}
+
+	const size_t count;
+	const std::function<T(size_t)> load;
+	const size_t maxInFlight;
+
+	std::vector<T> items;
+	std::vector<bool> ready;
+	size_t claimed = 0;
+	size_t consumed = 0;
+	bool stopping = false;
+
+	std::mutex mutex;
+	std::condition_variable claimable;
+	std::condition_variable loaded;
+	std::vector<std::thread> workers;
+};
+
+#endif // PREFETCHER_H
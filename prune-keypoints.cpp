@@ -0,0 +1,220 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <numeric>
+#include <algorithm>
+#include <unistd.h>
+#include <colmap/base/database.h>
+#include "matchability-model.h"
+#include "instrumentation.h"
+
+//
+// Writes a copy of a COLMAP database that keeps only the keypoints a
+// matchability model scores highest -- the top K of each image and/or
+// those above a score threshold -- so that matching runs on fewer
+// keypoints. Cameras and images keep their ids; the kept keypoints and
+// their descriptors keep their relative order, so they stay in sync.
+// Matches and two view geometries are not copied since the output is
+// meant to be matched again. With -m the kept keypoints' original
+// indices are written as IMGID,I,ORIGINAL rows.
+//
+// The database is read and written on the main thread (a colmap::Database
+// connection is not meant to be shared between threads); images are
+// scored in parallel in batches.
+//
+int main(int argc, char *argv[]) {
+    size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t topK = 0;           // 0 => no limit
+    float minScore = 0;
+    std::string mapCSV;
+
+    auto usage = [&]() {
+        std::cerr << "usage: " << argv[0] << " [-j threads] [-k top-K] [-s min-score] [-m index-map.csv] "
+                  << "[-t trace.json] model.bin database.db pruned.db\n";
+        exit(-1);
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:k:s:m:t:")) != -1) {
+        switch (opt) {
+        case 'j': numThreads = std::max(1, std::atoi(optarg)); break;
+        case 'k': topK = size_t(std::max(0, std::atoi(optarg))); break;
+        case 's': minScore = float(std::atof(optarg)); break;
+        case 'm': mapCSV = optarg; break;
+        case 't': enableTrace(optarg); break;
+        default: usage();
+        }
+    }
+    if (argc - optind != 3)
+        usage();
+    if (topK == 0 && minScore <= 0) {
+        std::cerr << "Need a top-K (-k) and/or a minimum score (-s)\n";
+        exit(-1);
+    }
+
+    const std::string modelPath(argv[optind]);
+    const std::string databasePath(argv[optind+1]);
+    const std::string prunedPath(argv[optind+2]);
+    if (databasePath == prunedPath) {
+        std::cerr << "The pruned database must be a new file\n";
+        exit(-1);
+    }
+
+    MatchabilityModel model;
+    if (!model.Read(modelPath)) {
+        std::cerr << "Unable to read model '" << modelPath << "'\n";
+        exit(-1);
+    }
+    const MatchabilityScorer scorer(model);
+
+    std::ifstream databaseFile(databasePath);
+    if (!databaseFile.is_open()) {
+        std::cerr << "Database '" << databasePath << "' does not exist!\n";
+        exit(-1);
+    }
+    databaseFile.close();
+
+    std::ofstream map;
+    if (!mapCSV.empty()) {
+        map.open(mapCSV);
+        if (!map.is_open()) {
+            std::cerr << "Unable to open '" << mapCSV << "' for writing!\n";
+            exit(-1);
+        }
+        map << "IMGID,I,ORIGINAL\n";
+    }
+
+    colmap::Database database(databasePath);
+    std::remove(prunedPath.c_str());
+    colmap::Database pruned(prunedPath);
+    colmap::DatabaseTransaction transaction(&pruned);
+
+    std::vector<colmap::Image> images;
+    {
+        TraceStage stage("database read");
+        for (auto&& camera : database.ReadAllCameras())
+            pruned.WriteCamera(camera, true);
+        images = database.ReadAllImages();
+        for (auto&& image : images)
+            pruned.WriteImage(image, true);
+        stage.AddRows(images.size());
+    }
+
+    //
+    // One image's keypoints: read, scored and pruned in place.
+    //
+    struct ImageFeatures {
+        colmap::image_t imageId;
+        colmap::FeatureKeypoints keypoints;
+        colmap::FeatureDescriptors descriptors;
+        std::vector<uint32_t> kept;   // original indices of the kept keypoints
+    };
+
+    auto prune = [&](ImageFeatures& features, std::vector<FeatureRow>& rows, std::vector<float>& scores) {
+        const size_t n = features.keypoints.size();
+        rows.resize(n);
+        scores.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            const colmap::FeatureKeypoint& kp = features.keypoints[i];
+            FeatureRow& row = rows[i];
+            row.kx = kp.x;
+            row.ky = kp.y;
+            row.a11 = kp.a11;
+            row.a12 = kp.a12;
+            row.a21 = kp.a21;
+            row.a22 = kp.a22;
+            for (int c = 0; c < 128; c++)
+                row.descriptor[c] = features.descriptors(i, c);
+        }
+        scorer.Score(rows.data(), n, scores.data());
+
+        std::vector<uint32_t>& kept = features.kept;
+        kept.clear();
+        for (uint32_t i = 0; i < n; i++)
+            if (scores[i] >= minScore)
+                kept.push_back(i);
+        if (topK > 0 && kept.size() > topK) {
+            std::nth_element(kept.begin(), kept.begin() + topK, kept.end(), [&](uint32_t a, uint32_t b) {
+                return scores[a] > scores[b];
+            });
+            kept.resize(topK);
+            std::sort(kept.begin(), kept.end());
+        }
+
+        colmap::FeatureKeypoints keypoints(kept.size());
+        colmap::FeatureDescriptors descriptors(kept.size(), features.descriptors.cols());
+        for (size_t k = 0; k < kept.size(); k++) {
+            keypoints[k] = features.keypoints[kept[k]];
+            descriptors.row(k) = features.descriptors.row(kept[k]);
+        }
+        features.keypoints = std::move(keypoints);
+        features.descriptors = std::move(descriptors);
+    };
+
+    const size_t batchSize = 4 * numThreads;
+    std::vector<ImageFeatures> batch;
+    std::vector<std::vector<FeatureRow>> threadRows(numThreads);
+    std::vector<std::vector<float>> threadScores(numThreads);
+    size_t totalKeypoints = 0, keptKeypoints = 0;
+    for (size_t first = 0; first < images.size(); first += batchSize) {
+        const size_t last = std::min(images.size(), first + batchSize);
+        batch.resize(last - first);
+        {
+            TraceStage stage("keypoint read");
+            for (size_t b = 0; b < batch.size(); b++) {
+                ImageFeatures& features = batch[b];
+                features.imageId = images[first + b].ImageId();
+                features.keypoints = database.ReadKeypoints(features.imageId);
+                features.descriptors = database.ReadDescriptors(features.imageId);
+                if (size_t(features.descriptors.rows()) != features.keypoints.size() ||
+                    (features.descriptors.rows() > 0 && features.descriptors.cols() != 128)) {
+                    std::cerr << "Image " << features.imageId << " has "
+                              << features.keypoints.size() << " keypoints but "
+                              << features.descriptors.rows() << "x" << features.descriptors.cols()
+                              << " descriptors\n";
+                    exit(-1);
+                }
+                stage.AddRows(features.keypoints.size());
+                stage.AddBytes(features.descriptors.size());
+                totalKeypoints += features.keypoints.size();
+            }
+        }
+        {
+            TraceStage stage("score");
+            std::vector<std::thread> threads;
+            auto work = [&](size_t t) {
+                for (size_t b = t; b < batch.size(); b += numThreads)
+                    prune(batch[b], threadRows[t], threadScores[t]);
+            };
+            for (size_t t = 1; t < numThreads; t++)
+                threads.emplace_back(work, t);
+            work(0);
+            for (auto&& thread : threads)
+                thread.join();
+        }
+        {
+            TraceStage stage("keypoint write");
+            for (auto&& features : batch) {
+                pruned.WriteKeypoints(features.imageId, features.keypoints);
+                pruned.WriteDescriptors(features.imageId, features.descriptors);
+                if (map.is_open())
+                    for (size_t k = 0; k < features.kept.size(); k++)
+                        map << features.imageId << "," << k << "," << features.kept[k] << "\n";
+                stage.AddRows(features.keypoints.size());
+                keptKeypoints += features.keypoints.size();
+            }
+        }
+        traceCounter("images", batch.size());
+        std::cout << "\r" << last << " of " << images.size() << " images pruned" << std::flush;
+    }
+    std::cout << "\n";
+
+    std::cout << "kept " << keptKeypoints << " of " << totalKeypoints << " keypoints ("
+              << (totalKeypoints > 0 ? 100.0 * keptKeypoints / totalKeypoints : 0.0) << "%)\n";
+
+    return 0;
+}
@@ -0,0 +1,254 @@
+//
+// Benchmarks for the rectpack2D finders and empty space providers on
+// synthetic rectangle sets:
+//
+//   features     -- sizes drawn like feature-patches' featureToPatch():
+//                   the bounding box of a SIFT-like affine frame scaled
+//                   by 1.5, plus padding
+//   uniform      -- sides uniform in [8,64]
+//   adversarial  -- thin slivers mixed with small squares, which splits
+//                   the empty spaces into many narrow ones
+//
+// Each benchmark reports time, the number of repacks (resets of the
+// empty spaces) per packing and the density of the result (packed area
+// over bin area). Typical use:
+//
+//   rectpack2D-benchmark --benchmark_filter='features/.*/10000'
+//
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "rectpack2D/finders_interface.h"
+#include "rectpack2D/anytime_finder.h"
+#include "rectpack2D/shelf_packer.h"
+
+namespace {
+
+//
+// Counts how often the empty spaces are reset, i.e. how often the
+// rectangles are repacked into a candidate bin.
+//
+std::atomic<size_t> repackCount{0};   // find_best_packing_parallel repacks on several threads
+
+template <class Provider>
+class CountingSpaces : public Provider {
+public:
+    void reset() {
+        repackCount++;
+        Provider::reset();
+    }
+};
+
+enum Distribution { FEATURES, UNIFORM, ADVERSARIAL };
+
+const char* distributionName(Distribution d) {
+    switch (d) {
+    case FEATURES: return "features";
+    case UNIFORM: return "uniform";
+    default: return "adversarial";
+    }
+}
+
+std::vector<rectpack2D::rect_wh> makeSizes(Distribution distribution, size_t n) {
+    std::mt19937 rng(12345);
+    std::vector<rectpack2D::rect_wh> sizes;
+    sizes.reserve(n);
+    const int padding = 4;
+    const int maxPatchSide = 64;
+    for (size_t i = 0; i < n; i++) {
+        if (distribution == FEATURES) {
+            //
+            // Keypoint scales are roughly log-normal, with most features
+            // at the finest octaves; affine frames are mildly anisotropic.
+            //
+            std::lognormal_distribution<double> scale(std::log(2.5), 0.6);
+            std::normal_distribution<double> anisotropy(0, 0.25);
+            std::uniform_real_distribution<double> angle(-M_PI, M_PI);
+            const double bboxScale = 1.5;
+            const double s = scale(rng), a = std::exp(anisotropy(rng)), t = angle(rng);
+            const double scaleX = s * a * bboxScale, scaleY = s / a * bboxScale;
+            const double c = std::cos(t), si = std::sin(t);
+            const double bboxWidth = std::sqrt(scaleX*scaleX*c*c + scaleY*scaleY*si*si);
+            const double bboxHeight = std::sqrt(scaleX*scaleX*si*si + scaleY*scaleY*c*c);
+            int W = std::max(2, int(std::ceil(2*bboxWidth)));
+            int H = std::max(2, int(std::ceil(2*bboxHeight)));
+            if (std::max(W, H) > maxPatchSide) {
+                const double r = double(maxPatchSide) / std::max(W, H);
+                W = std::max(2, int(std::lround(W*r)));
+                H = std::max(2, int(std::lround(H*r)));
+            }
+            sizes.emplace_back(W + padding, H + padding);
+        } else if (distribution == UNIFORM) {
+            std::uniform_int_distribution<int> side(8, 64);
+            sizes.emplace_back(side(rng), side(rng));
+        } else {
+            std::uniform_int_distribution<int> thin(1, 3);
+            std::uniform_int_distribution<int> longSide(64, 256);
+            std::uniform_int_distribution<int> square(4, 16);
+            switch (i % 3) {
+            case 0: sizes.emplace_back(thin(rng), longSide(rng)); break;
+            case 1: sizes.emplace_back(longSide(rng), thin(rng)); break;
+            default: { const int side = square(rng); sizes.emplace_back(side, side); }
+            }
+        }
+    }
+    return sizes;
+}
+
+//
+// rect_wh::area() is an int, so no bin side may exceed sqrt(INT_MAX).
+//
+constexpr int maxIntSide = 46340;
+
+//
+// Largest bin side: everything fits into one bin up to the largest size,
+// so the finders measure the bin search rather than failures. Returns 0
+// when that bin would be too large for int areas.
+//
+int maxBinSide(const std::vector<rectpack2D::rect_wh>& sizes) {
+    double area = 0;
+    int longest = 0;
+    for (auto&& s : sizes) {
+        area += s.area();
+        longest = std::max(longest, s.max_side());
+    }
+    const double side = std::max(double(longest), std::ceil(2 * std::sqrt(area)));
+    return side > maxIntSide ? 0 : int(side);
+}
+
+enum Finder { BEST, PARALLEL, DONT_SORT, ANYTIME, PAGES, SHELF };
+
+template <bool allowFlip, class Provider>
+void packRectangles(benchmark::State& state, Finder finder, Distribution distribution) {
+    using spaces_type = rectpack2D::empty_spaces<allowFlip, CountingSpaces<Provider>>;
+    using rect_type = rectpack2D::output_rect_t<spaces_type>;
+
+    const auto sizes = makeSizes(distribution, size_t(state.range(0)));
+    const int maxSide = (finder == PAGES || finder == SHELF) ? 2000 : maxBinSide(sizes);
+    if (maxSide == 0) {
+        state.SkipWithError("a single bin for all rectangles would overflow int areas");
+        return;
+    }
+
+    double packedArea = 0;
+    auto input = rectpack2D::make_finder_input(
+        maxSide,
+        -4,
+        [&](rect_type& r) {
+            packedArea += r.area();
+            return rectpack2D::callback_result::CONTINUE_PACKING;
+        },
+        [](rect_type&) {
+            return rectpack2D::callback_result::CONTINUE_PACKING;
+        },
+        allowFlip ? rectpack2D::flipping_option::ENABLED : rectpack2D::flipping_option::DISABLED
+        );
+
+    std::vector<rect_type> rectangles;
+    std::vector<int> page;
+    size_t repacks = 0, packings = 0;
+    double density = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        rectangles.clear();
+        for (auto&& s : sizes)
+            rectangles.emplace_back(rectpack2D::rect_xywh(0, 0, s.w, s.h));
+        packedArea = 0;
+        repackCount = 0;
+        state.ResumeTiming();
+
+        std::vector<rectpack2D::rect_wh> bins;
+        switch (finder) {
+        case BEST:
+            bins.push_back(rectpack2D::find_best_packing<spaces_type>(rectangles, input));
+            break;
+        case PARALLEL:
+            bins.push_back(rectpack2D::find_best_packing_parallel<spaces_type>(rectangles, input));
+            break;
+        case DONT_SORT:
+            bins.push_back(rectpack2D::find_best_packing_dont_sort<spaces_type>(rectangles, input));
+            break;
+        case ANYTIME: {
+            rectpack2D::packing_stats stats;
+            bins.push_back(rectpack2D::find_best_packing_anytime<spaces_type>(
+                rectangles, input, rectpack2D::packing_budget::within(std::chrono::milliseconds(100)), stats));
+            break;
+        }
+        case PAGES:
+            bins = rectpack2D::find_packing_pages<spaces_type>(rectangles, page, input);
+            break;
+        case SHELF:
+            bins = rectpack2D::find_shelf_packing_pages<spaces_type>(rectangles, page, input);
+            break;
+        }
+
+        double binArea = 0;
+        for (auto&& b : bins)
+            binArea += b.area();
+        density += binArea > 0 ? packedArea / binArea : 0;
+        repacks += repackCount;
+        packings++;
+    }
+
+    state.counters["repacks"] = double(repacks) / std::max<size_t>(1, packings);
+    state.counters["density"] = density / std::max<size_t>(1, packings);
+    state.counters["rects/s"] = benchmark::Counter(double(sizes.size()), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+//
+// The default and static providers scan every empty space for every
+// rectangle, which is impractical beyond 100k rectangles, so they stop
+// there. The
+// single bin finders stop at 100k with any provider: a single bin for
+// 1M rectangles is wider than maxIntSide.
+//
+template <bool allowFlip, class Provider>
+void registerFinders(const std::string& providerName, int maxCount) {
+    const std::pair<Finder, const char*> finders[] = {
+        {BEST, "find_best_packing"},
+        {PARALLEL, "find_best_packing_parallel"},
+        {DONT_SORT, "find_best_packing_dont_sort"},
+        {ANYTIME, "find_best_packing_anytime"},
+        {PAGES, "find_packing_pages"},
+        {SHELF, "find_shelf_packing_pages"},
+    };
+    for (Distribution distribution : {FEATURES, UNIFORM, ADVERSARIAL})
+        for (auto&& finder : finders) {
+            const std::string name = std::string(distributionName(distribution)) + "/" + finder.second + "/"
+                + providerName + (allowFlip ? "/flip" : "/noflip");
+            auto* benchmark = benchmark::RegisterBenchmark(name.c_str(), packRectangles<allowFlip, Provider>,
+                                                           finder.first, distribution);
+            if (finder.first == PARALLEL)
+                benchmark->UseRealTime();   // the main thread mostly waits
+            benchmark
+                ->RangeMultiplier(10)
+                ->Range(1000, finder.first == SHELF ? 1000000
+                              : finder.first == PAGES ? maxCount
+                              : std::min(maxCount, 100000))
+                ->Unit(benchmark::kMillisecond);
+        }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    registerFinders<false, rectpack2D::default_empty_spaces>("default", 100000);
+    registerFinders<true, rectpack2D::default_empty_spaces>("default", 100000);
+    registerFinders<false, rectpack2D::static_empty_spaces<10000>>("static", 100000);
+    registerFinders<true, rectpack2D::static_empty_spaces<10000>>("static", 100000);
+    registerFinders<false, rectpack2D::indexed_empty_spaces>("indexed", 1000000);
+    registerFinders<true, rectpack2D::indexed_empty_spaces>("indexed", 1000000);
+    registerFinders<false, rectpack2D::soa_empty_spaces>("soa", 1000000);
+    registerFinders<true, rectpack2D::soa_empty_spaces>("soa", 1000000);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,361 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <variant>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <type_traits>
+
+#include "finders_interface.h"
+
+namespace rectpack2D {
+	/*
+		Limits on the work done by find_best_packing_anytime.
+		Every attempt to pack all rectangles into a candidate bin counts as one repack.
+	*/
+
+	struct packing_budget {
+		using clock = std::chrono::steady_clock;
+
+		clock::time_point deadline = clock::time_point::max();
+		int max_repacks = std::numeric_limits<int>::max();
+
+		static packing_budget within(const clock::duration d) {
+			packing_budget b;
+			b.deadline = clock::now() + d;
+			return b;
+		}
+	};
+
+	struct packing_stats {
+		int repacks = 0;
+		bool budget_exhausted = false;
+
+		/* Area of the rectangles that were packed, divided by the area of the returned bin. */
+		double density = 0;
+	};
+
+	/*
+		A bin search that stops as soon as the budget runs out, remembering the best bin found so far.
+
+		Instead of starting at half of the largest bin like best_packing_for_ordering_impl,
+		each dimension is bisected between a lower bound (the total area and the largest rectangle)
+		and the smallest bin known to hold all rectangles, which for similarly sized rectangles
+		is usually only a few repacks apart.
+
+		Since whether the rectangles fit is not monotone in the bin size, the two searches
+		visit different candidates and generally end at different (similarly dense) bins,
+		even with an unlimited budget.
+
+		A negative discard_step means the same as for best_packing_for_ordering_impl:
+		the search goes on to a precision of 1, and then tries up to -discard_step more
+		sides below the smallest one that fit before settling on it.
+	*/
+
+	template <class empty_spaces_type>
+	class budgeted_bin_search {
+		empty_spaces_type& root;
+		const packing_budget& budget;
+		packing_stats& stats;
+		const int discard_step;
+		const int tries_before_discarding;
+
+	public:
+		budgeted_bin_search(
+			empty_spaces_type& root,
+			const packing_budget& budget,
+			packing_stats& stats,
+			const int discard_step
+		) :
+			root(root),
+			budget(budget),
+			stats(stats),
+			discard_step(std::max(1, discard_step)),
+			tries_before_discarding(std::max(0, -discard_step))
+		{}
+
+		bool exhausted() {
+			if (!stats.budget_exhausted) {
+				stats.budget_exhausted =
+					stats.repacks >= budget.max_repacks
+					|| (budget.deadline != packing_budget::clock::time_point::max() && packing_budget::clock::now() >= budget.deadline)
+				;
+			}
+
+			return stats.budget_exhausted;
+		}
+
+		template <class O>
+		std::variant<total_area_type, rect_wh> try_bin(const O& ordering, const rect_wh bin) {
+			++stats.repacks;
+			root.reset(bin);
+
+			total_area_type total_inserted_area = 0;
+
+			for (const auto& r : ordering) {
+				const auto& rect = dereference(r);
+
+				if (root.insert(rect.get_wh())) {
+					total_inserted_area += rect.area();
+				}
+				else {
+					return total_inserted_area;
+				}
+			}
+
+			return bin;
+		}
+
+		/*
+			Returns the smallest bin found, or how much area fit into max_bin if not everything did.
+			Returns nothing if the budget ran out before max_bin could be tried.
+		*/
+
+		template <class O>
+		std::optional<std::variant<total_area_type, rect_wh>> search(const O& ordering, const rect_wh max_bin) {
+			if (exhausted()) {
+				return std::nullopt;
+			}
+
+			const auto first = try_bin(ordering, max_bin);
+
+			if (std::holds_alternative<total_area_type>(first)) {
+				return first;
+			}
+
+			double total_area = 0;
+			int widest = 0;
+			int tallest = 0;
+			int longest = 0;
+
+			for (const auto& r : ordering) {
+				const auto wh = dereference(r).get_wh();
+				total_area += wh.area();
+				widest = std::max(widest, wh.w);
+				tallest = std::max(tallest, wh.h);
+				longest = std::max(longest, wh.max_side());
+			}
+
+			if (std::is_same_v<output_rect_t<empty_spaces_type>, rect_xywhf> && root.flipping_mode == flipping_option::ENABLED) {
+				/* Flipped rectangles only need their shorter side to fit across. */
+				widest = 0;
+
+				for (const auto& r : ordering) {
+					widest = std::max(widest, dereference(r).get_wh().min_side());
+				}
+
+				tallest = widest;
+			}
+
+			auto best = max_bin;
+
+			/*
+				Searches one side of the bin between lower (assumed not to fit) and the best one (known to fit).
+				The lower bound is usually close, so the steps away from it first grow geometrically,
+				and only then is the interval bisected. This finds a good bin within a few repacks.
+			*/
+
+			auto bisect = [&](int lower, auto side_of, auto make_bin) {
+				int upper = side_of(best);
+				lower = std::min(lower, upper);
+				const int bound = lower;
+
+				int gallop = std::max(discard_step, lower / 16);
+
+				while (upper - lower > discard_step && !exhausted()) {
+					int mid = lower + (upper - lower) / 2;
+
+					if (gallop > 0) {
+						if (lower + gallop < mid) {
+							mid = lower + gallop;
+							gallop *= 2;
+						}
+						else {
+							gallop = 0;
+						}
+					}
+
+					const auto candidate = make_bin(mid);
+
+					if (std::holds_alternative<rect_wh>(try_bin(ordering, candidate))) {
+						upper = mid;
+						best = candidate;
+						gallop = 0;
+					}
+					else {
+						lower = mid;
+					}
+				}
+
+				for (int tries = tries_before_discarding, side = upper - 1; tries > 0 && side > bound && !exhausted(); --tries, --side) {
+					const auto candidate = make_bin(side);
+
+					if (std::holds_alternative<rect_wh>(try_bin(ordering, candidate))) {
+						best = candidate;
+					}
+				}
+			};
+
+			const int square_lower = std::max(static_cast<int>(std::ceil(std::sqrt(total_area))), longest) - 1;
+
+			bisect(
+				square_lower,
+				[](const rect_wh b) { return b.w; },
+				[&](const int s) { return rect_wh(s, s); }
+			);
+
+			bisect(
+				std::max(static_cast<int>(std::ceil(total_area / best.h)), widest) - 1,
+				[](const rect_wh b) { return b.w; },
+				[&](const int w) { return rect_wh(w, best.h); }
+			);
+
+			bisect(
+				std::max(static_cast<int>(std::ceil(total_area / best.w)), tallest) - 1,
+				[](const rect_wh b) { return b.h; },
+				[&](const int h) { return rect_wh(best.w, h); }
+			);
+
+			return best;
+		}
+	};
+
+	/*
+		Anytime version of find_best_packing, for when predictable latency matters more
+		than the last bit of density.
+
+		The orders are searched one after another, each with budgeted_bin_search,
+		until the budget runs out. The best order and bin found up to then are used,
+		and the results are written and reported exactly like find_best_packing does.
+		If the budget runs out before even the first order could be tried,
+		the rectangles are packed into the largest bin in the first order.
+
+		The final packing counts as one more repack, so it may exceed max_repacks by one
+		and the deadline by the time of one repack.
+	*/
+
+	template <class empty_spaces_type, class F, class G, class Comparator, class... Comparators>
+	rect_wh find_best_packing_anytime(
+		std::vector<output_rect_t<empty_spaces_type>>& subjects,
+		const finder_input<F, G>& input,
+		const packing_budget& budget,
+		packing_stats& stats,
+
+		Comparator comparator,
+		Comparators... comparators
+	) {
+		using rect_type = output_rect_t<empty_spaces_type>;
+		using order_type = std::vector<rect_type*>;
+
+		stats = packing_stats();
+
+		const auto max_bin = rect_wh(input.max_bin_side, input.max_bin_side);
+
+		constexpr auto count_orders = 1 + sizeof...(Comparators);
+		std::array<order_type, count_orders> orders;
+
+		for (auto& s : subjects) {
+			if (s.area() > 0) {
+				orders[0].emplace_back(std::addressof(s));
+			}
+		}
+
+		for (std::size_t i = 1; i < count_orders; ++i) {
+			orders[i] = orders[0];
+		}
+
+		std::size_t f = 0;
+
+		auto make_order = [&f, &orders](auto& predicate) {
+			std::sort(orders[f].begin(), orders[f].end(), predicate);
+			++f;
+		};
+
+		make_order(comparator);
+		(make_order(comparators), ...);
+
+		empty_spaces_type root = rect_wh();
+		root.flipping_mode = input.flipping_mode;
+
+		budgeted_bin_search<empty_spaces_type> search(root, budget, stats, input.discard_step);
+		best_order_selector<order_type> selected(max_bin);
+
+		for (auto& o : orders) {
+			const auto packing = search.search(o, max_bin);
+
+			if (!packing) {
+				break;
+			}
+
+			selected.consider(o, *packing);
+		}
+
+		if (selected.best_order == nullptr) {
+			selected.best_order = std::addressof(orders[0]);
+		}
+
+		double packed_area = 0;
+
+		const auto counting_input = make_finder_input(
+			input.max_bin_side,
+			input.discard_step,
+			[&](rect_type& r) {
+				packed_area += r.area();
+				return input.handle_successful_insertion(r);
+			},
+			[&](rect_type& r) {
+				return input.handle_unsuccessful_insertion(r);
+			},
+			input.flipping_mode
+		);
+
+		++stats.repacks;
+		const auto result = insert_best_order(root, selected, counting_input);
+
+		stats.density = result.area() > 0 ? packed_area / result.area() : 0;
+		return result;
+	}
+
+	/*
+		Anytime version of find_best_packing with the same comparison predicates.
+	*/
+
+	template <class empty_spaces_type, class F, class G>
+	rect_wh find_best_packing_anytime(
+		std::vector<output_rect_t<empty_spaces_type>>& subjects,
+		const finder_input<F, G>& input,
+		const packing_budget& budget,
+		packing_stats& stats
+	) {
+		using rect_type = output_rect_t<empty_spaces_type>;
+
+		return find_best_packing_anytime<empty_spaces_type>(
+			subjects,
+			input,
+			budget,
+			stats,
+
+			[](const rect_type* const a, const rect_type* const b) {
+				return a->area() > b->area();
+			},
+			[](const rect_type* const a, const rect_type* const b) {
+				return a->perimeter() > b->perimeter();
+			},
+			[](const rect_type* const a, const rect_type* const b) {
+				return std::max(a->w, a->h) > std::max(b->w, b->h);
+			},
+			[](const rect_type* const a, const rect_type* const b) {
+				return a->w > b->w;
+			},
+			[](const rect_type* const a, const rect_type* const b) {
+				return a->h > b->h;
+			},
+			[](const rect_type* const a, const rect_type* const b) {
+				return a->get_wh().pathological_mult() > b->get_wh().pathological_mult();
+			}
+		);
+	}
+}
@@ -1,6 +1,9 @@
 #pragma once
 #include <variant>
 #include <cassert>
+#include <future>
+#include <thread>
+#include <vector>
 #include "rect_structs.h"
 
 namespace rectpack2D {
@@ -47,7 +50,7 @@ namespace rectpack2D {
 	template <class empty_spaces_type, class O>
 	std::variant<total_area_type, rect_wh> best_packing_for_ordering_impl(
 		empty_spaces_type& root,
-		O ordering,
+		const O& ordering,
 		const rect_wh starting_bin,
 		int discard_step,
 		const bin_dimension tried_dimension
@@ -171,7 +174,7 @@ namespace rectpack2D {
 		) {
 			return best_packing_for_ordering_impl(
 				root,
-				std::forward<O>(ordering),
+				ordering,
 				starting_bin,
 				discard_step,
 				tried_dimension
@@ -200,6 +203,77 @@ namespace rectpack2D {
 		return best_bin;
 	}
 
+	/*
+		Chooses the best ordering given the packing results of all orderings,
+		which have to be considered in the order the orderings were generated.
+	*/
+
+	template <class OrderType>
+	struct best_order_selector {
+		OrderType* best_order = nullptr;
+		int best_total_inserted = -1;
+		rect_wh best_bin;
+
+		best_order_selector(const rect_wh max_bin) : best_bin(max_bin) {}
+
+		void consider(OrderType& current_order, const std::variant<total_area_type, rect_wh>& packing) {
+			if (const auto total_inserted = std::get_if<total_area_type>(&packing)) {
+				/*
+					Track which function inserts the most area in total,
+					just in case that all orders will fail to fit into the largest allowed bin.
+				*/
+				if (best_order == nullptr) {
+					if (*total_inserted > best_total_inserted) {
+						best_order = std::addressof(current_order);
+						best_total_inserted = *total_inserted;
+					}
+				}
+			}
+			else if (const auto result_bin = std::get_if<rect_wh>(&packing)) {
+				/* Save the function if it performed the best. */
+				if (result_bin->area() <= best_bin.area()) {
+					best_order = std::addressof(current_order);
+					best_bin = *result_bin;
+				}
+			}
+		}
+	};
+
+	/*
+		Packs the best order into the best bin, writing the results
+		and reporting which of the rectangles did and did not fit.
+	*/
+
+	template <class empty_spaces_type, class OrderType, class I>
+	rect_wh insert_best_order(
+		empty_spaces_type& root,
+		const best_order_selector<OrderType>& selected,
+		const I& input
+	) {
+		assert(selected.best_order != nullptr);
+		
+		root.reset(selected.best_bin);
+
+		for (auto& rr : *selected.best_order) {
+			auto& rect = dereference(rr);
+
+			if (const auto ret = root.insert(rect.get_wh())) {
+				rect = *ret;
+
+				if (callback_result::ABORT_PACKING == input.handle_successful_insertion(rect)) {
+					break;
+				}
+			}
+			else {
+				if (callback_result::ABORT_PACKING == input.handle_unsuccessful_insertion(rect)) {
+					break;
+				}
+			}
+		}
+
+		return root.get_rects_aabb();
+	}
+
 	/*
 		This function will try to find the best bin size among the ones generated by all provided rectangle orders.
 		Only the best order will have results written to.
@@ -216,10 +290,7 @@ namespace rectpack2D {
 	rect_wh find_best_packing_impl(F for_each_order, const I input) {
 		const auto max_bin = rect_wh(input.max_bin_side, input.max_bin_side);
 
-		OrderType* best_order = nullptr;
-
-		int best_total_inserted = -1;
-		auto best_bin = max_bin;
+		best_order_selector<OrderType> selected(max_bin);
 
 		/* 
 			The root node is re-used on the TLS. 
@@ -237,50 +308,122 @@ namespace rectpack2D {
 				input.discard_step
 			);
 
-			if (const auto total_inserted = std::get_if<total_area_type>(&packing)) {
-				/*
-					Track which function inserts the most area in total,
-					just in case that all orders will fail to fit into the largest allowed bin.
-				*/
-				if (best_order == nullptr) {
-					if (*total_inserted > best_total_inserted) {
-						best_order = std::addressof(current_order);
-						best_total_inserted = *total_inserted;
-					}
-				}
-			}
-			else if (const auto result_bin = std::get_if<rect_wh>(&packing)) {
-				/* Save the function if it performed the best. */
-				if (result_bin->area() <= best_bin.area()) {
-					best_order = std::addressof(current_order);
-					best_bin = *result_bin;
-				}
-			}
+			selected.consider(current_order, packing);
 		});
 
-		{
-			assert(best_order != nullptr);
-			
-			root.reset(best_bin);
+		return insert_best_order(root, selected, input);
+	}
 
-			for (auto& rr : *best_order) {
-				auto& rect = dereference(rr);
+	/*
+		Same as best_packing_for_ordering, but the HEIGHT refinement is run speculatively
+		on another thread (with its own empty spaces), concurrently with the WIDTH refinement,
+		starting from the bin found for BOTH dimensions.
 
-				if (const auto ret = root.insert(rect.get_wh())) {
-					rect = *ret;
+		If the WIDTH refinement improved the bin, the HEIGHT refinement has to start from that bin instead,
+		so it is re-run; otherwise the speculative result is exactly what the serial version computes.
+	*/
 
-					if (callback_result::ABORT_PACKING == input.handle_successful_insertion(rect)) {
-						break;
-					}
-				}
-				else {
-					if (callback_result::ABORT_PACKING == input.handle_unsuccessful_insertion(rect)) {
-						break;
-					}
-				}
+	template <class empty_spaces_type, class O>
+	std::variant<total_area_type, rect_wh> best_packing_for_ordering_parallel(
+		empty_spaces_type& root,
+		const O& ordering,
+		const rect_wh starting_bin,
+		const int discard_step
+	) {
+		const auto best_result = best_packing_for_ordering_impl(
+			root, ordering, starting_bin, discard_step, bin_dimension::BOTH
+		);
+
+		if (const auto failed = std::get_if<total_area_type>(&best_result)) {
+			return *failed;
+		}
+
+		const auto both_bin = std::get<rect_wh>(best_result);
+
+		auto speculative_height = std::async(std::launch::async, [&]() {
+			empty_spaces_type height_root = rect_wh();
+			height_root.flipping_mode = root.flipping_mode;
+
+			return best_packing_for_ordering_impl(
+				height_root, ordering, both_bin, discard_step, bin_dimension::HEIGHT
+			);
+		});
+
+		auto best_bin = both_bin;
+
+		const auto width_trial = best_packing_for_ordering_impl(
+			root, ordering, both_bin, discard_step, bin_dimension::WIDTH
+		);
+
+		if (const auto better = std::get_if<rect_wh>(&width_trial)) {
+			best_bin = *better;
+		}
+
+		const bool width_improved = best_bin.w != both_bin.w || best_bin.h != both_bin.h;
+
+		auto height_trial = speculative_height.get();
+
+		if (width_improved) {
+			height_trial = best_packing_for_ordering_impl(
+				root, ordering, best_bin, discard_step, bin_dimension::HEIGHT
+			);
+		}
+
+		if (const auto better = std::get_if<rect_wh>(&height_trial)) {
+			best_bin = *better;
+		}
+
+		return best_bin;
+	}
+
+	/*
+		Parallel version of find_best_packing_impl.
+		Every order is evaluated on its own thread with its own empty spaces.
+		The winner is then chosen exactly as find_best_packing_impl does,
+		considering the orders in the same sequence, so both pick the same order and bin.
+	*/
+
+	template <
+		class empty_spaces_type, 
+		class OrderType,
+		class I
+	>
+	rect_wh find_best_packing_parallel_impl(std::vector<OrderType*>& orders, const I input) {
+		const auto max_bin = rect_wh(input.max_bin_side, input.max_bin_side);
+
+		std::vector<std::variant<total_area_type, rect_wh>> packings(orders.size());
+
+		{
+			std::vector<std::thread> threads;
+
+			for (std::size_t i = 0; i < orders.size(); ++i) {
+				threads.emplace_back([&, i]() {
+					empty_spaces_type root = rect_wh();
+					root.flipping_mode = input.flipping_mode;
+
+					packings[i] = best_packing_for_ordering_parallel(
+						root,
+						*orders[i],
+						max_bin,
+						input.discard_step
+					);
+				});
 			}
 
-			return root.get_rects_aabb();
+			for (auto& t : threads) {
+				t.join();
+			}
+		}
+
+		best_order_selector<OrderType> selected(max_bin);
+
+		for (std::size_t i = 0; i < orders.size(); ++i) {
+			selected.consider(*orders[i], packings[i]);
 		}
+
+		empty_spaces_type root = rect_wh();
+		root.flipping_mode = input.flipping_mode;
+
+		return insert_best_order(root, selected, input);
 	}
 }
@@ -2,6 +2,11 @@
 #include <array>
 #include <vector>
 #include <type_traits>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #include "rect_structs.h"
 
@@ -67,4 +72,247 @@ namespace rectpack2D {
 			return empty_spaces[i];
 		}
 	};
+
+	/*
+		Keeps the spaces in the same order as default_empty_spaces (removal moves the last space into the hole),
+		plus an implicit binary tree over their indices. Every node holds upper bounds of the spaces below it:
+		the largest width, the largest height and the largest shorter side. The last bound is what rules out
+		the many thin strips left over by splitting, which the first two alone cannot.
+
+		find_last_fitting walks the tree from the right, skipping every subtree that cannot hold the image,
+		so it finds the same space as trying every space from the back - without visiting them all.
+	*/
+
+	class indexed_empty_spaces {
+		struct bounds_type {
+			int w = 0;
+			int h = 0;
+			int min_side = 0;
+
+			bounds_type() = default;
+			bounds_type(const rect_wh& r) : w(r.w), h(r.h), min_side(r.min_side()) {}
+
+			bool operator==(const bounds_type& b) const {
+				return w == b.w && h == b.h && min_side == b.min_side;
+			}
+		};
+
+		std::vector<space_rect> empty_spaces;
+		std::vector<bounds_type> tree;
+		int leaves = 0;
+		int used_leaves = 0;
+
+		static bounds_type combine(const bounds_type& a, const bounds_type& b) {
+			bounds_type result;
+			result.w = std::max(a.w, b.w);
+			result.h = std::max(a.h, b.h);
+			result.min_side = std::max(a.min_side, b.min_side);
+			return result;
+		}
+
+		static bool may_fit(const bounds_type& bounds, const rect_wh& im, const bool try_flipped) {
+			if (bounds.min_side < im.min_side()) {
+				return false;
+			}
+
+			return (bounds.w >= im.w && bounds.h >= im.h) || (try_flipped && bounds.w >= im.h && bounds.h >= im.w);
+		}
+
+		void update(const int i) {
+			int n = leaves + i;
+			tree[n] = i < static_cast<int>(empty_spaces.size()) ? bounds_type(empty_spaces[i].get_wh()) : bounds_type();
+
+			for (n /= 2; n >= 1; n /= 2) {
+				const auto bounds = combine(tree[2 * n], tree[2 * n + 1]);
+
+				if (bounds == tree[n]) {
+					/* Nothing changes further up. */
+					break;
+				}
+
+				tree[n] = bounds;
+			}
+		}
+
+		void grow() {
+			leaves = std::max(64, 2 * leaves);
+			tree.assign(2 * leaves, bounds_type());
+
+			for (std::size_t i = 0; i < empty_spaces.size(); ++i) {
+				tree[leaves + i] = bounds_type(empty_spaces[i].get_wh());
+			}
+
+			for (int n = leaves - 1; n >= 1; --n) {
+				tree[n] = combine(tree[2 * n], tree[2 * n + 1]);
+			}
+		}
+
+		int search(const int n, const int lo, const int hi, const int upto, const rect_wh& im, const bool try_flipped) const {
+			if (lo > upto || !may_fit(tree[n], im, try_flipped)) {
+				return -1;
+			}
+
+			if (hi - lo == 1) {
+				return lo;
+			}
+
+			const int mid = (lo + hi) / 2;
+			const int right = search(2 * n + 1, mid, hi, upto, im, try_flipped);
+
+			return right >= 0 ? right : search(2 * n, lo, mid, upto, im, try_flipped);
+		}
+
+	public:
+		void remove(const int i) {
+			empty_spaces[i] = empty_spaces.back();
+			empty_spaces.pop_back();
+
+			update(i);
+			update(static_cast<int>(empty_spaces.size()));
+		}
+
+		bool add(const space_rect r) {
+			empty_spaces.emplace_back(r);
+			used_leaves = std::max(used_leaves, static_cast<int>(empty_spaces.size()));
+
+			if (static_cast<int>(empty_spaces.size()) > leaves) {
+				grow();
+			}
+			else {
+				update(static_cast<int>(empty_spaces.size()) - 1);
+			}
+
+			return true;
+		}
+
+		auto get_count() const {
+			return empty_spaces.size();
+		}
+
+		void reset() {
+			empty_spaces.clear();
+
+			/* Only clear the nodes above leaves that were used since the last reset. */
+			for (int first = leaves, last = leaves + used_leaves; first >= 1 && last > first; first /= 2, last = (last + 1) / 2) {
+				std::fill(tree.begin() + first, tree.begin() + last, bounds_type());
+			}
+
+			used_leaves = 0;
+		}
+
+		const auto& get(const int i) {
+			return empty_spaces[i];
+		}
+
+		int find_last_fitting(const int upto, const rect_wh& im, const bool try_flipped) const {
+			/*
+				The last few spaces - the most recent splits - are the likeliest to fit,
+				and checking them directly is cheaper than walking the tree.
+			*/
+
+			const int direct_end = std::max(-1, upto - 16);
+
+			for (int i = upto; i > direct_end; --i) {
+				if (may_fit(bounds_type(empty_spaces[i].get_wh()), im, try_flipped)) {
+					return i;
+				}
+			}
+
+			if (direct_end < 0) {
+				return -1;
+			}
+
+			return search(1, 0, leaves, direct_end, im, try_flipped);
+		}
+	};
+
+	/*
+		Structure-of-arrays storage: the positions and sizes of the spaces live in separate arrays,
+		in the same order as default_empty_spaces, so find_last_fitting can test eight spaces at once
+		(with AVX2) for the last one that can hold the image. Only that space is then split.
+	*/
+
+	class soa_empty_spaces {
+		std::vector<int> xs;
+		std::vector<int> ys;
+		std::vector<int> ws;
+		std::vector<int> hs;
+
+		static bool fits(const int w, const int h, const rect_wh& im, const bool try_flipped) {
+			return (w >= im.w && h >= im.h) || (try_flipped && w >= im.h && h >= im.w);
+		}
+
+	public:
+		void remove(const int i) {
+			xs[i] = xs.back();
+			ys[i] = ys.back();
+			ws[i] = ws.back();
+			hs[i] = hs.back();
+
+			xs.pop_back();
+			ys.pop_back();
+			ws.pop_back();
+			hs.pop_back();
+		}
+
+		bool add(const space_rect r) {
+			xs.push_back(r.x);
+			ys.push_back(r.y);
+			ws.push_back(r.w);
+			hs.push_back(r.h);
+			return true;
+		}
+
+		auto get_count() const {
+			return ws.size();
+		}
+
+		void reset() {
+			xs.clear();
+			ys.clear();
+			ws.clear();
+			hs.clear();
+		}
+
+		space_rect get(const int i) const {
+			return space_rect(xs[i], ys[i], ws[i], hs[i]);
+		}
+
+		int find_last_fitting(const int upto, const rect_wh& im, const bool try_flipped) const {
+			int i = upto;
+
+#if defined(__AVX2__)
+			/* w >= W is computed as w > W - 1. */
+			const __m256i im_w = _mm256_set1_epi32(im.w - 1);
+			const __m256i im_h = _mm256_set1_epi32(im.h - 1);
+
+			for (; i >= 7; i -= 8) {
+				const __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ws.data() + i - 7));
+				const __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hs.data() + i - 7));
+
+				__m256i fit = _mm256_and_si256(_mm256_cmpgt_epi32(w, im_w), _mm256_cmpgt_epi32(h, im_h));
+
+				if (try_flipped) {
+					const __m256i flipped = _mm256_and_si256(_mm256_cmpgt_epi32(w, im_h), _mm256_cmpgt_epi32(h, im_w));
+					fit = _mm256_or_si256(fit, flipped);
+				}
+
+				const int mask = _mm256_movemask_ps(_mm256_castsi256_ps(fit));
+
+				if (mask != 0) {
+					/* The highest set lane is the last fitting space. */
+					return i - 7 + (31 - __builtin_clz(static_cast<unsigned>(mask)));
+				}
+			}
+#endif
+
+			for (; i >= 0; --i) {
+				if (fits(ws[i], hs[i], im, try_flipped)) {
+					return i;
+				}
+			}
+
+			return -1;
+		}
+	};
 }
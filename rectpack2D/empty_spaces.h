@@ -1,4 +1,7 @@
 #pragma once
+#include <optional>
+#include <type_traits>
+#include <utility>
 #include "insert_and_split.h"
 
 namespace rectpack2D {
@@ -9,6 +12,18 @@ namespace rectpack2D {
 
 	class default_empty_spaces;
 
+	/*
+		Providers may answer "which is the last space, up to index i, that can hold the image?"
+		directly, with find_last_fitting(i, image, try_flipped). empty_spaces then visits only those
+		candidates instead of scanning every space, and still picks the same space as the scan.
+	*/
+
+	template <class T, class = void>
+	struct has_fit_query : std::false_type {};
+
+	template <class T>
+	struct has_fit_query<T, std::void_t<decltype(std::declval<const T&>().find_last_fitting(0, rect_wh(), false))>> : std::true_type {};
+
 	template <bool allow_flip, class empty_spaces_provider = default_empty_spaces>
 	class empty_spaces {
 		rect_wh current_aabb;
@@ -40,9 +55,25 @@ namespace rectpack2D {
 			spaces.add(rect_xywh(0, 0, r.w, r.h));
 		}
 
+		/*
+			The spaces are tried from the last one to the first.
+			report_candidate_empty_space is called for every space that is tried,
+			which for providers with a fit query is only the one that is chosen.
+		*/
+
 		template <class F>
 		std::optional<output_rect_type> insert(const rect_wh image_rectangle, F report_candidate_empty_space) {
-			for (int i = static_cast<int>(spaces.get_count()) - 1; i >= 0; --i) {
+			auto last_candidate = [&](const int i) {
+				if constexpr(has_fit_query<empty_spaces_provider>::value) {
+					const bool try_flipped = allow_flip && flipping_mode == flipping_option::ENABLED;
+					return i < 0 ? -1 : static_cast<int>(spaces.find_last_fitting(i, image_rectangle, try_flipped));
+				}
+				else {
+					return i;
+				}
+			};
+
+			for (int i = last_candidate(static_cast<int>(spaces.get_count()) - 1); i >= 0; i = last_candidate(i - 1)) {
 				const auto candidate_space = spaces.get(i);
 
 				report_candidate_empty_space(candidate_space);
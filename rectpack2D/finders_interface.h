@@ -66,6 +66,11 @@ namespace rectpack2D {
 	   
 		The function will try to pack the rectangles in all orders generated by the predicates,
 		and will only write the x, y coordinates of the best packing found among the orders.
+
+		The subjects themselves are never reordered - the orders only hold pointers to them.
+		The result for subjects[i] is written to subjects[i], and both callbacks receive a reference
+		to the subject, so the caller can identify a rectangle by its index (&r - subjects.data())
+		without storing an id in it.
 	*/
 
 	template <class empty_spaces_type, class F, class G, class Comparator, class... Comparators>
@@ -116,6 +121,70 @@ namespace rectpack2D {
 		);
 	}
 
+	/*
+		Opt-in parallel version of find_best_packing.
+
+		Every order is sorted and evaluated on its own thread with its own empty spaces,
+		and the HEIGHT refinement of each order runs concurrently with its WIDTH refinement.
+		The chosen order and bin are the same as find_best_packing would choose.
+	*/
+
+	template <class empty_spaces_type, class F, class G, class Comparator, class... Comparators>
+	rect_wh find_best_packing_parallel(
+		std::vector<output_rect_t<empty_spaces_type>>& subjects,
+		const finder_input<F, G>& input,
+
+		Comparator comparator,
+		Comparators... comparators
+	) {
+		using rect_type = output_rect_t<empty_spaces_type>;
+		using order_type = std::vector<rect_type*>;
+
+		constexpr auto count_orders = 1 + sizeof...(Comparators);
+		std::array<order_type, count_orders> orders;
+
+		{
+			auto& initial_pointers = orders[0];
+
+			for (auto& s : subjects) {
+				if (s.area() > 0) {
+					initial_pointers.emplace_back(std::addressof(s));
+				}
+			}
+
+			for (std::size_t i = 1; i < count_orders; ++i) {
+				orders[i] = initial_pointers;
+			}
+		}
+
+		{
+			std::vector<std::thread> sorters;
+			std::size_t f = 0;
+
+			auto make_order = [&f, &orders, &sorters](auto& predicate) {
+				sorters.emplace_back([&order = orders[f], predicate]() {
+					std::sort(order.begin(), order.end(), predicate);
+				});
+				++f;
+			};
+
+			make_order(comparator);
+			(make_order(comparators), ...);
+
+			for (auto& t : sorters) {
+				t.join();
+			}
+		}
+
+		std::vector<order_type*> order_pointers;
+
+		for (auto& o : orders) {
+			order_pointers.push_back(std::addressof(o));
+		}
+
+		return find_best_packing_parallel_impl<empty_spaces_type>(order_pointers, input);
+	}
+
 	/*
 		Finds the best packing for the rectangles.
 		Provides a list of several sensible comparison predicates.
@@ -152,4 +221,225 @@ namespace rectpack2D {
 			}
 		);
 	}
+
+	/*
+		Opt-in parallel version of find_best_packing with the same comparison predicates.
+	*/
+
+	template <class empty_spaces_type, class F, class G>
+	rect_wh find_best_packing_parallel(
+		std::vector<output_rect_t<empty_spaces_type>>& subjects,
+		const finder_input<F, G>& input
+	) {
+		using rect_type = output_rect_t<empty_spaces_type>;
+
+		return find_best_packing_parallel<empty_spaces_type>(
+			subjects,
+			input,
+
+			[](const rect_type* const a, const rect_type* const b) {
+				return a->area() > b->area();
+			},
+			[](const rect_type* const a, const rect_type* const b) {
+				return a->perimeter() > b->perimeter();
+			},
+			[](const rect_type* const a, const rect_type* const b) {
+				return std::max(a->w, a->h) > std::max(b->w, b->h);
+			},
+			[](const rect_type* const a, const rect_type* const b) {
+				return a->w > b->w;
+			},
+			[](const rect_type* const a, const rect_type* const b) {
+				return a->h > b->h;
+			},
+			[](const rect_type* const a, const rect_type* const b) {
+				return a->get_wh().pathological_mult() > b->get_wh().pathological_mult();
+			}
+		);
+	}
+
+	/*
+		Packs the rectangles into a sequence of pages, none larger than max_bin_side x max_bin_side,
+		for when they do not all fit into a single bin.
+
+		The rectangles are sorted by the comparator, and each page is filled with as many of the
+		remaining rectangles as fit into it, in that order. The last page is then shrunk
+		with the same bin search that find_best_packing uses for a single ordering.
+
+		As with find_best_packing, the subjects are not reordered: the result for subjects[i]
+		is written to subjects[i], and page_of_subject[i] receives the index of its page
+		(or -1 if it was not packed). Rectangles that do not fit even into an empty page
+		are reported through handle_unsuccessful_insertion.
+
+		Returns the size of every page.
+	*/
+
+	template <class empty_spaces_type, class F, class G, class Comparator>
+	std::vector<rect_wh> find_packing_pages(
+		std::vector<output_rect_t<empty_spaces_type>>& subjects,
+		std::vector<int>& page_of_subject,
+		const finder_input<F, G>& input,
+		Comparator comparator
+	) {
+		using rect_type = output_rect_t<empty_spaces_type>;
+		using order_type = std::vector<rect_type*>;
+
+		const auto max_bin = rect_wh(input.max_bin_side, input.max_bin_side);
+
+		std::vector<rect_wh> pages;
+		page_of_subject.assign(subjects.size(), -1);
+
+		order_type remaining;
+		order_type too_big;
+
+		for (auto& s : subjects) {
+			if (s.area() > 0) {
+				if (s.get_wh().max_side() > input.max_bin_side) {
+					too_big.emplace_back(std::addressof(s));
+				}
+				else {
+					remaining.emplace_back(std::addressof(s));
+				}
+			}
+		}
+
+		std::sort(remaining.begin(), remaining.end(), comparator);
+
+		/* 
+			Placements are kept aside until the page is final,
+			so the subjects keep their original (unflipped) dimensions while trying.
+		*/
+
+		empty_spaces_type root = rect_wh();
+		root.flipping_mode = input.flipping_mode;
+
+		order_type page;
+		order_type leftover;
+		std::vector<rect_type> placements;
+
+		while (!remaining.empty()) {
+			page.clear();
+			leftover.clear();
+			placements.clear();
+
+			root.reset(max_bin);
+
+			for (auto* r : remaining) {
+				if (const auto ret = root.insert(r->get_wh())) {
+					page.push_back(r);
+					placements.push_back(*ret);
+				}
+				else {
+					leftover.push_back(r);
+				}
+			}
+
+			if (page.empty()) {
+				/* Nothing left fits even into an empty page. */
+				break;
+			}
+
+			auto page_bin = root.get_rects_aabb();
+
+			if (leftover.empty()) {
+				const auto best = best_packing_for_ordering(root, page, max_bin, input.discard_step);
+
+				if (const auto best_bin = std::get_if<rect_wh>(&best)) {
+					root.reset(*best_bin);
+
+					const bool all_inserted = [&]() {
+						for (std::size_t i = 0; i < page.size(); ++i) {
+							if (const auto ret = root.insert(page[i]->get_wh())) {
+								placements[i] = *ret;
+							}
+							else {
+								return false;
+							}
+						}
+
+						return true;
+					}();
+
+					assert(all_inserted);
+					(void)all_inserted;
+					page_bin = root.get_rects_aabb();
+				}
+			}
+
+			const int page_index = static_cast<int>(pages.size());
+			pages.push_back(page_bin);
+
+			for (std::size_t i = 0; i < page.size(); ++i) {
+				auto& rect = *page[i];
+				rect = placements[i];
+				page_of_subject[page[i] - subjects.data()] = page_index;
+
+				if (callback_result::ABORT_PACKING == input.handle_successful_insertion(rect)) {
+					return pages;
+				}
+			}
+
+			remaining.swap(leftover);
+		}
+
+		remaining.insert(remaining.end(), too_big.begin(), too_big.end());
+
+		for (auto* r : remaining) {
+			if (callback_result::ABORT_PACKING == input.handle_unsuccessful_insertion(*r)) {
+				break;
+			}
+		}
+
+		return pages;
+	}
+
+	/*
+		Packs the rectangles into pages, largest area first.
+	*/
+
+	template <class empty_spaces_type, class F, class G>
+	std::vector<rect_wh> find_packing_pages(
+		std::vector<output_rect_t<empty_spaces_type>>& subjects,
+		std::vector<int>& page_of_subject,
+		const finder_input<F, G>& input
+	) {
+		using rect_type = output_rect_t<empty_spaces_type>;
+
+		return find_packing_pages<empty_spaces_type>(
+			subjects,
+			page_of_subject,
+			input,
+
+			[](const rect_type* const a, const rect_type* const b) {
+				return a->area() > b->area();
+			}
+		);
+	}
+
+	/*
+		The fraction of the pages' area covered by the rectangles packed into them,
+		for comparing packers.
+	*/
+
+	template <class R>
+	double packing_density(
+		const std::vector<R>& subjects,
+		const std::vector<int>& page_of_subject,
+		const std::vector<rect_wh>& pages
+	) {
+		double packed_area = 0;
+		double pages_area = 0;
+
+		for (std::size_t i = 0; i < subjects.size(); ++i) {
+			if (page_of_subject[i] >= 0) {
+				packed_area += subjects[i].area();
+			}
+		}
+
+		for (const auto& p : pages) {
+			pages_area += p.area();
+		}
+
+		return pages_area > 0 ? packed_area / pages_area : 0;
+	}
 }
@@ -0,0 +1,140 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+
+#include "finders_interface.h"
+
+namespace rectpack2D {
+	/*
+		A shelf packer, for inputs whose rectangles have similar sizes (like feature patches),
+		where the empty spaces packer and its bin size search cost far more than they gain.
+
+		The rectangles are sorted by decreasing height and placed left to right on shelves
+		as tall as the first rectangle placed on them. A shelf that is full is closed and a new one
+		is opened on top of it; a page that is full is closed and a new one is started.
+		There is no repacking: the whole run is a sort plus a single pass, O(n log n).
+
+		The page width is chosen so that, if everything fits into one page, the page is roughly square.
+		If flipping is allowed and enabled, every rectangle is laid flat (width >= height),
+		which keeps the shelves low.
+
+		Takes the same finder_input as the other finders (the discard step is unused), writes the results
+		in place like find_packing_pages, and returns the size of every page.
+	*/
+
+	template <class empty_spaces_type, class F, class G>
+	std::vector<rect_wh> find_shelf_packing_pages(
+		std::vector<output_rect_t<empty_spaces_type>>& subjects,
+		std::vector<int>& page_of_subject,
+		const finder_input<F, G>& input
+	) {
+		using rect_type = output_rect_t<empty_spaces_type>;
+		constexpr bool allow_flip = std::is_same_v<rect_type, rect_xywhf>;
+
+		const bool lay_flat = allow_flip && input.flipping_mode == flipping_option::ENABLED;
+		const int max_side = input.max_bin_side;
+
+		std::vector<rect_wh> pages;
+		page_of_subject.assign(subjects.size(), -1);
+
+		struct item {
+			rect_type* subject;
+			rect_wh wh;
+			bool flipped;
+		};
+
+		std::vector<item> items;
+		double total_area = 0;
+		int widest = 0;
+
+		for (auto& s : subjects) {
+			if (s.area() > 0) {
+				auto wh = s.get_wh();
+				const bool flipped = lay_flat && wh.h > wh.w;
+
+				if (flipped) {
+					wh.flip();
+				}
+
+				items.push_back({ std::addressof(s), wh, flipped });
+				total_area += wh.area();
+				widest = std::max(widest, wh.w);
+			}
+		}
+
+		std::sort(items.begin(), items.end(), [](const item& a, const item& b) {
+			return a.wh.h > b.wh.h || (a.wh.h == b.wh.h && a.wh.w > b.wh.w);
+		});
+
+		const int page_width = std::min(max_side, std::max(widest, static_cast<int>(std::ceil(std::sqrt(total_area)))));
+
+		int x = 0;
+		int shelf_y = 0;
+		int shelf_h = 0;
+		rect_wh page_aabb;
+		std::vector<item*> unplaced;
+
+		auto close_page = [&]() {
+			if (page_aabb.area() > 0) {
+				pages.push_back(page_aabb);
+			}
+
+			x = shelf_y = shelf_h = 0;
+			page_aabb = rect_wh();
+		};
+
+		for (auto& it : items) {
+			if (it.wh.w > page_width || it.wh.h > max_side) {
+				unplaced.push_back(&it);
+				continue;
+			}
+
+			if (x + it.wh.w > page_width) {
+				/* Open a new shelf. */
+				shelf_y += shelf_h;
+				x = shelf_h = 0;
+			}
+
+			if (shelf_y + it.wh.h > max_side) {
+				close_page();
+			}
+
+			if (shelf_h == 0) {
+				shelf_h = it.wh.h;
+			}
+
+			const auto result = [&]() {
+				if constexpr(allow_flip) {
+					/* rect_xywhf takes the unflipped dimensions. */
+					const auto original = it.subject->get_wh();
+					return rect_xywhf(x, shelf_y, original.w, original.h, it.flipped);
+				}
+				else {
+					return rect_xywh(x, shelf_y, it.wh.w, it.wh.h);
+				}
+			}();
+
+			*it.subject = result;
+			page_of_subject[it.subject - subjects.data()] = static_cast<int>(pages.size());
+			page_aabb.expand_with(result);
+			x += it.wh.w;
+
+			if (callback_result::ABORT_PACKING == input.handle_successful_insertion(*it.subject)) {
+				close_page();
+				return pages;
+			}
+		}
+
+		close_page();
+
+		for (auto* it : unplaced) {
+			if (callback_result::ABORT_PACKING == input.handle_unsuccessful_insertion(*it->subject)) {
+				break;
+			}
+		}
+
+		return pages;
+	}
+}
@@ -0,0 +1,224 @@
+#include "region-decoder.h"
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#ifdef HAVE_JPEG_CROP_SCANLINE
+#include <jpeglib.h>
+#endif
+
+int reducedDecodeScale(const std::vector<cv::Rect>& regions,
+					   const std::vector<cv::Size>& targetSizes) {
+	if (regions.empty()) return 1;
+	for (int scale : {8, 4, 2}) {
+		bool permitted = true;
+		for (size_t i = 0; i < regions.size() && permitted; i++)
+			permitted = regions[i].width >= scale * targetSizes[i].width &&
+						regions[i].height >= scale * targetSizes[i].height;
+		if (permitted) return scale;
+	}
+	return 1;
+}
+
+namespace {
+
+bool isJpeg(const std::string& path) {
+	FILE* file = std::fopen(path.c_str(), "rb");
+	if (file == nullptr) return false;
+	unsigned char magic[2] = {0, 0};
+	const size_t n = std::fread(magic, 1, 2, file);
+	std::fclose(file);
+	return n == 2 && magic[0] == 0xFF && magic[1] == 0xD8;
+}
+
+//
+// Full resolution size of a JPEG (from its SOF marker) or PNG (from its
+// IHDR chunk) without decoding it; empty for other formats or on errors.
+// Neither applies the EXIF orientation.
+//
+cv::Size headerImageSize(const std::string& path) {
+	FILE* file = std::fopen(path.c_str(), "rb");
+	if (file == nullptr) return cv::Size();
+	cv::Size size;
+	unsigned char b[24];
+	if (std::fread(b, 1, 2, file) == 2 && b[0] == 0xFF && b[1] == 0xD8) {
+		// markers up to the first SOFn (C0-CF except DHT C4, JPG C8 and DAC CC)
+		while (std::fread(b, 1, 4, file) == 4 && b[0] == 0xFF) {
+			const int marker = b[1];
+			const long length = (b[2] << 8) | b[3];
+			if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+				if (std::fread(b, 1, 5, file) == 5)
+					size = cv::Size((b[3] << 8) | b[4], (b[1] << 8) | b[2]);
+				break;
+			}
+			if (length < 2 || std::fseek(file, length - 2, SEEK_CUR) != 0)
+				break;
+		}
+	} else if (std::fseek(file, 0, SEEK_SET) == 0 && std::fread(b, 1, 24, file) == 24 &&
+			   std::memcmp(b, "\x89PNG\r\n\x1a\n", 8) == 0 && std::memcmp(b + 12, "IHDR", 4) == 0) {
+		auto be32 = [&](int i) { return int((b[i] << 24) | (b[i+1] << 16) | (b[i+2] << 8) | b[i+3]); };
+		size = cv::Size(be32(16), be32(20));
+	}
+	std::fclose(file);
+	return size;
+}
+
+//
+// Region decoding needs libjpeg-turbo's jpeg_crop_scanline,
+// jpeg_skip_scanlines and JCS_EXT_BGR; CMake defines
+// HAVE_JPEG_CROP_SCANLINE when libjpeg provides them.
+//
+#ifdef HAVE_JPEG_CROP_SCANLINE
+
+struct JpegErrorManager {
+	jpeg_error_mgr pub;
+	jmp_buf jump;
+};
+
+void jpegErrorExit(j_common_ptr cinfo) {
+	JpegErrorManager* err = reinterpret_cast<JpegErrorManager*>(cinfo->err);
+	longjmp(err->jump, 1);
+}
+
+//
+// The libjpeg calls are isolated in functions that only have trivially
+// destructible locals since errors longjmp back to their setjmp.
+//
+bool readJpegHeader(j_decompress_ptr cinfo, JpegErrorManager& err, int scale, bool grayscale) {
+	if (setjmp(err.jump)) return false;
+	jpeg_read_header(cinfo, TRUE);
+	cinfo->scale_num = 1;
+	cinfo->scale_denom = scale;
+	cinfo->out_color_space = grayscale ? JCS_GRAYSCALE : JCS_EXT_BGR;
+	jpeg_calc_output_dimensions(cinfo);
+	return true;
+}
+
+bool readJpegRows(j_decompress_ptr cinfo, JpegErrorManager& err,
+				  const std::vector<std::pair<int,int>>& rows,
+				  int x0, int x1,
+				  unsigned char *pixels, size_t stride,
+				  unsigned char *buffer) {
+	if (setjmp(err.jump)) return false;
+	jpeg_start_decompress(cinfo);
+
+	// Cropping rounds x0 down to an iMCU boundary and widens the row.
+	JDIMENSION xoffset = x0;
+	JDIMENSION width = x1 - x0;
+	if (width < cinfo->output_width)
+		jpeg_crop_scanline(cinfo, &xoffset, &width);
+	const int components = cinfo->output_components;
+
+	for (auto&& range : rows) {
+		if (cinfo->output_scanline < JDIMENSION(range.first))
+			jpeg_skip_scanlines(cinfo, range.first - cinfo->output_scanline);
+		while (cinfo->output_scanline < JDIMENSION(range.second)) {
+			const JDIMENSION y = cinfo->output_scanline;
+			JSAMPROW row = buffer;
+			jpeg_read_scanlines(cinfo, &row, 1);
+			std::copy(buffer, buffer + width*components, pixels + y*stride + xoffset*components);
+		}
+	}
+
+	// Not every scanline has been read, so abort instead of finish.
+	jpeg_abort_decompress(cinfo);
+	return true;
+}
+
+DecodedImage decodeJpegRegions(const std::string& path,
+							   const std::vector<cv::Rect>& regions,
+							   int scale,
+							   bool grayscale) {
+	DecodedImage decoded;
+	FILE* file = std::fopen(path.c_str(), "rb");
+	if (file == nullptr) return decoded;
+
+	jpeg_decompress_struct cinfo;
+	JpegErrorManager err;
+	cinfo.err = jpeg_std_error(&err.pub);
+	err.pub.error_exit = jpegErrorExit;
+	jpeg_create_decompress(&cinfo);
+	jpeg_stdio_src(&cinfo, file);
+
+	if (readJpegHeader(&cinfo, err, scale, grayscale)) {
+		const int W = cinfo.output_width;
+		const int H = cinfo.output_height;
+
+		//
+		// Merge the regions' scaled row ranges and column extent.
+		//
+		std::vector<std::pair<int,int>> rows;
+		int x0 = W, x1 = 0;
+		for (auto&& r : regions) {
+			const int top = std::max(0, r.y / scale);
+			const int bottom = std::min(H, (r.y + r.height + scale - 1) / scale);
+			const int left = std::max(0, r.x / scale);
+			const int right = std::min(W, (r.x + r.width + scale - 1) / scale);
+			if (top >= bottom || left >= right) continue;
+			rows.emplace_back(top, bottom);
+			x0 = std::min(x0, left);
+			x1 = std::max(x1, right);
+		}
+		std::sort(rows.begin(), rows.end());
+		std::vector<std::pair<int,int>> merged;
+		for (auto&& range : rows) {
+			if (!merged.empty() && range.first <= merged.back().second)
+				merged.back().second = std::max(merged.back().second, range.second);
+			else
+				merged.push_back(range);
+		}
+
+		cv::Mat image(H, W, grayscale ? CV_8UC1 : CV_8UC3, cv::Scalar(0, 0, 0));
+		std::vector<unsigned char> buffer(size_t(W) * cinfo.output_components);
+		if (merged.empty() ||
+			readJpegRows(&cinfo, err, merged, x0, x1, image.data, image.step, buffer.data())) {
+			decoded.image = image;
+			decoded.scale = scale;
+			decoded.size = cv::Size(cinfo.image_width, cinfo.image_height);
+		}
+	}
+
+	jpeg_destroy_decompress(&cinfo);
+	std::fclose(file);
+	return decoded;
+}
+
+#endif // HAVE_JPEG_CROP_SCANLINE
+
+} // namespace
+
+DecodedImage decodeImageRegions(const std::string& path,
+								const std::vector<cv::Rect>& regions,
+								int scale,
+								bool grayscale) {
+#ifdef HAVE_JPEG_CROP_SCANLINE
+	if (isJpeg(path)) {
+		DecodedImage decoded = decodeJpegRegions(path, regions, scale, grayscale);
+		if (!decoded.image.empty())
+			return decoded;
+	}
+#endif
+
+	//
+	// cv::imread with IMREAD_REDUCED_* when the full resolution size can
+	// be read from the header, and otherwise at full resolution (scale 1).
+	//
+	DecodedImage decoded;
+	const cv::Size size = scale > 1 ? headerImageSize(path) : cv::Size();
+	if (size.area() > 0) {
+		const int flags = grayscale ?
+			(scale == 8 ? cv::IMREAD_REDUCED_GRAYSCALE_8 :
+			 scale == 4 ? cv::IMREAD_REDUCED_GRAYSCALE_4 : cv::IMREAD_REDUCED_GRAYSCALE_2) :
+			(scale == 8 ? cv::IMREAD_REDUCED_COLOR_8 :
+			 scale == 4 ? cv::IMREAD_REDUCED_COLOR_4 : cv::IMREAD_REDUCED_COLOR_2);
+		decoded.image = cv::imread(path, flags | cv::IMREAD_IGNORE_ORIENTATION);
+		decoded.scale = scale;
+		decoded.size = size;
+	} else {
+		decoded.image = cv::imread(path, (grayscale ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR) |
+								   cv::IMREAD_IGNORE_ORIENTATION);
+		decoded.scale = 1;
+		decoded.size = decoded.image.size();
+	}
+	return decoded;
+}
@@ -0,0 +1,45 @@
+#ifndef REGION_DECODER_H
+#define REGION_DECODER_H
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+//
+// Decoded (possibly reduced resolution) source image. Only the pixels
+// covering the requested regions are guaranteed to be decoded; the rest
+// of the image is black. A pixel (x,y) of the full resolution image maps
+// to (x/scale, y/scale) in image.
+//
+struct DecodedImage {
+	cv::Mat image;
+	int scale = 1;    // 1, 2, 4 or 8
+	cv::Size size;    // full resolution image size
+};
+
+//
+// Largest JPEG DCT scale (1, 2, 4 or 8) that still leaves every source
+// region at least as large as the size it will be resized to.
+//
+int reducedDecodeScale(const std::vector<cv::Rect>& regions,
+					   const std::vector<cv::Size>& targetSizes);
+
+//
+// Decodes the parts of the image at path that intersect the given
+// full resolution regions at 1/scale resolution. JPEG files are decoded
+// with libjpeg using DCT scaling, skipping the MCU rows above, between
+// and below the regions and cropping the columns to the regions' extent.
+// This needs libjpeg-turbo; without it, and for other formats, the whole
+// image is read with cv::imread, with IMREAD_REDUCED_* for JPEG and PNG
+// (whose size can be read from the header) and otherwise at full
+// resolution, so check decoded.scale. Like COLMAP, no path applies the
+// EXIF orientation, so the coordinates match the keypoint coordinates.
+// The image is 8-bit BGR, or 8-bit gray when grayscale is set. Returns
+// an empty image on failure.
+//
+DecodedImage decodeImageRegions(const std::string& path,
+								const std::vector<cv::Rect>& regions,
+								int scale,
+								bool grayscale = false);
+
+#endif // REGION_DECODER_H
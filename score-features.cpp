@@ -0,0 +1,125 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <unistd.h>
+#include "feature-reader.h"
+#include "matchability-model.h"
+#include "instrumentation.h"
+
+//
+// Scores every feature of a features CSV (as written by feature-data)
+// with a matchability model and writes N,SCORE rows. The CSV is read in
+// blocks of lines; each block is parsed, scored and formatted in
+// parallel and written in order.
+//
+int main(int argc, char *argv[]) {
+    size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t blockRows = 1 << 16;
+
+    auto usage = [&]() {
+        std::cerr << "usage: " << argv[0] << " [-j threads] [-b block-rows] [-t trace.json] "
+                  << "model.bin features.csv scores.csv\n";
+        exit(-1);
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:b:t:")) != -1) {
+        switch (opt) {
+        case 'j': numThreads = std::max(1, std::atoi(optarg)); break;
+        case 'b': blockRows = std::max(1, std::atoi(optarg)); break;
+        case 't': enableTrace(optarg); break;
+        default: usage();
+        }
+    }
+    if (argc - optind != 3)
+        usage();
+
+    const std::string modelPath(argv[optind]);
+    const std::string featuresCSV(argv[optind+1]);
+    const std::string scoresCSV(argv[optind+2]);
+
+    MatchabilityModel model;
+    if (!model.Read(modelPath)) {
+        std::cerr << "Unable to read model '" << modelPath << "'\n";
+        exit(-1);
+    }
+    const MatchabilityScorer scorer(model);
+
+    FeatureReader reader(featuresCSV);
+    if (!reader.IsOpen()) {
+        std::cerr << "Unable to open '" << featuresCSV << "'\n";
+        exit(-1);
+    }
+    std::ofstream csv(scoresCSV);
+    if (!csv.is_open()) {
+        std::cerr << "Unable to open '" << scoresCSV << "' for writing!\n";
+        exit(-1);
+    }
+    csv << "N,SCORE\n";
+
+    FeatureBlock block;
+    std::vector<FeatureRow> rows;
+    std::vector<float> scores;
+    std::vector<std::string> output(numThreads);
+    std::vector<size_t> malformed(numThreads);
+    size_t total = 0;
+
+    while (true) {
+        size_t n;
+        {
+            TraceStage stage("read");
+            n = reader.ReadBlock(block, blockRows);
+            stage.AddRows(n);
+        }
+        if (n == 0) break;
+        rows.resize(n);
+        scores.resize(n);
+
+        TraceStage stage("score");
+        stage.AddRows(n);
+        auto work = [&](size_t t) {
+            const size_t begin = n * t / numThreads;
+            const size_t end = n * (t + 1) / numThreads;
+            size_t m = 0;   // well-formed rows, compacted to the front of [begin,end)
+            for (size_t i = begin; i < end; i++)
+                if (parseFeatureRow(block.LineBegin(i), block.LineEnd(i), rows[begin + m]))
+                    m++;
+            malformed[t] += (end - begin) - m;
+            scorer.Score(rows.data() + begin, m, scores.data() + begin);
+            std::string& text = output[t];
+            text.clear();
+            char line[64];
+            for (size_t i = begin; i < begin + m; i++) {
+                const int length = std::snprintf(line, sizeof(line), "%lld,%.6f\n",
+                                                 (long long)rows[i].num, scores[i]);
+                text.append(line, length);
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < numThreads; t++)
+            threads.emplace_back(work, t);
+        work(0);
+        for (auto&& thread : threads)
+            thread.join();
+
+        for (auto&& text : output)
+            csv << text;
+        total += n;
+        traceCounter("rows", n);
+        std::cout << "\r" << total << " features scored" << std::flush;
+    }
+    std::cout << "\n";
+
+    size_t numMalformed = 0;
+    for (size_t m : malformed)
+        numMalformed += m;
+    if (numMalformed > 0)
+        std::cerr << "warning: " << numMalformed << " malformed rows skipped\n";
+
+    return 0;
+}
@@ -0,0 +1,301 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <opencv2/opencv.hpp>
+#include <colmap/base/database.h>
+#include "reconstruction.h"
+#include "instrumentation.h"
+
+//
+// Writes a synthetic COLMAP workspace that the tools here can run on:
+//
+//   workspace/database.db            cameras, images, keypoints, descriptors,
+//                                    raw matches and two view geometries
+//   workspace/sparse/0/*.bin         reconstruction with 3D points and tracks
+//   workspace/images/imgNNNNN.jpg    procedurally generated source images
+//
+// Images look at a sequence of scene points: image i observes points from
+// a window that slides with i, so neighbouring images share points, as in
+// a video or a walk-through capture. Observations of the same scene point
+// get the same descriptor plus noise. Every pair of images within the
+// track length (-l) of each other is matched, and any other pair is matched
+// with the given match graph density. The matches of a pair are its shared
+// scene points (the inliers) plus random outliers in the given ratio.
+// Scene points seen by two or more images become 3D points. The poses and
+// 3D positions are random; the tools here only use the correspondences.
+//
+int main(int argc, char *argv[]) {
+    int numImages = 100;
+    int numKeypoints = 2000;
+    double matchDensity = 0.05;   // fraction of non-neighbouring image pairs that are matched
+    double inlierRatio = 0.5;     // fraction of a pair's matches that are inliers
+    double trackFraction = 0.5;   // fraction of keypoints that observe a scene point
+    int trackLength = 4;          // average number of images observing a scene point
+    int width = 1600, height = 1200;
+    unsigned seed = 1;
+
+    auto usage = [&]() {
+        std::cerr << "usage: " << argv[0] << " [-n images] [-k keypoints-per-image] [-d match-graph-density] "
+                  << "[-r inlier-ratio] [-f track-fraction] [-l track-length] [-W width] [-H height] [-S seed] "
+                  << "[-t trace.json] "
+                  << "workspace\n";
+        exit(-1);
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:k:d:r:f:l:W:H:S:t:")) != -1) {
+        switch (opt) {
+        case 'n': numImages = std::max(2, std::atoi(optarg)); break;
+        case 'k': numKeypoints = std::max(1, std::atoi(optarg)); break;
+        case 'd': matchDensity = std::atof(optarg); break;
+        case 'r': inlierRatio = std::atof(optarg); break;
+        case 'f': trackFraction = std::atof(optarg); break;
+        case 'l': trackLength = std::max(2, std::atoi(optarg)); break;
+        case 'W': width = std::max(64, std::atoi(optarg)); break;
+        case 'H': height = std::max(64, std::atoi(optarg)); break;
+        case 'S': seed = unsigned(std::atoi(optarg)); break;
+        case 't': enableTrace(optarg); break;
+        default: usage();
+        }
+    }
+    if (argc - optind != 1 || inlierRatio <= 0 || inlierRatio > 1 || trackFraction < 0 || trackFraction > 1)
+        usage();
+
+    const std::string workspace(argv[optind]);
+    const std::string imageFolder = workspace + "/images";
+    const std::string sparseFolder = workspace + "/sparse/0";
+    for (auto&& dir : {workspace, workspace + "/images", workspace + "/sparse", sparseFolder})
+        mkdir(dir.c_str(), 0755);
+
+    const std::string databasePath = workspace + "/database.db";
+    std::remove(databasePath.c_str());
+
+    std::mt19937 rng(seed);
+
+    auto imageName = [](int i) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "img%05d.jpg", i);
+        return std::string(name);
+    };
+
+    //
+    // Scene point observations of each image: (scene point, keypoint index),
+    // sorted by scene point. A window of 2*obs consecutive scene points
+    // starts every obs/trackLength points, and half of it is observed,
+    // so each scene point is seen by about trackLength images.
+    //
+    const int obs = int(numKeypoints * trackFraction);
+    const int stride = std::max(1, obs / trackLength);
+    std::vector<std::vector<std::pair<int,int>>> observations(numImages);
+    std::map<int,std::vector<std::pair<int,int>>> tracks; // scene point -> (image index, keypoint index)
+    for (int i = 0; i < numImages; i++) {
+        std::vector<int> window(2*obs);
+        for (int j = 0; j < 2*obs; j++)
+            window[j] = i*stride + j;
+        std::shuffle(window.begin(), window.end(), rng);
+        window.resize(obs);
+        std::sort(window.begin(), window.end());
+        std::vector<int> keypointIndices(numKeypoints);
+        for (int j = 0; j < numKeypoints; j++)
+            keypointIndices[j] = j;
+        std::shuffle(keypointIndices.begin(), keypointIndices.end(), rng);
+        for (int j = 0; j < obs; j++) {
+            observations[i].emplace_back(window[j], keypointIndices[j]);
+            tracks[window[j]].emplace_back(i, keypointIndices[j]);
+        }
+    }
+
+    //
+    // Keypoints and descriptors. Descriptor entries are SIFT-like: mostly
+    // small with a few large bins. A scene point's descriptor is derived
+    // from its id, so all its observations are near each other.
+    //
+    auto sceneDescriptor = [](int scenePoint) {
+        std::mt19937 pointRng(unsigned(scenePoint) * 2654435761u + 17);
+        std::gamma_distribution<float> bin(0.8f, 20.0f);
+        std::vector<float> d(128);
+        for (auto&& v : d)
+            v = bin(pointRng);
+        return d;
+    };
+
+    std::vector<colmap::FeatureKeypoints> keypoints(numImages);
+    std::vector<colmap::FeatureDescriptors> descriptors(numImages);
+    {
+        std::uniform_real_distribution<float> X(16.0f, width - 16.0f), Y(16.0f, height - 16.0f);
+        std::lognormal_distribution<float> scale(std::log(2.5f), 0.6f);
+        std::uniform_real_distribution<float> angle(-float(M_PI), float(M_PI));
+        std::gamma_distribution<float> bin(0.8f, 20.0f);
+        std::normal_distribution<float> noise(0.0f, 6.0f);
+        for (int i = 0; i < numImages; i++) {
+            std::vector<int> scenePointOf(numKeypoints, -1);
+            for (auto&& o : observations[i])
+                scenePointOf[o.second] = o.first;
+            keypoints[i].reserve(numKeypoints);
+            descriptors[i].resize(numKeypoints, 128);
+            for (int j = 0; j < numKeypoints; j++) {
+                const float s = scale(rng), t = angle(rng);
+                const float c = std::cos(t), si = std::sin(t);
+                keypoints[i].emplace_back(X(rng), Y(rng), s*c, -s*si, s*si, s*c);
+                std::vector<float> d;
+                if (scenePointOf[j] >= 0) {
+                    d = sceneDescriptor(scenePointOf[j]);
+                    for (auto&& v : d)
+                        v += noise(rng);
+                } else {
+                    d.resize(128);
+                    for (auto&& v : d)
+                        v = bin(rng);
+                }
+                for (int k = 0; k < 128; k++)
+                    descriptors[i](j,k) = uint8_t(std::min(255.0f, std::max(0.0f, d[k])));
+            }
+        }
+    }
+
+    //
+    // Source images: a smooth background with noise, and a textured
+    // ellipse at every keypoint so that the patches are not flat.
+    //
+    for (int i = 0; i < numImages; i++) {
+        cv::Mat image(height, width, CV_8UC3);
+        cv::randu(image, cv::Scalar(0, 0, 0), cv::Scalar(64, 64, 64));
+        image += cv::Scalar(40 + 3*(i % 32), 90, 140 - 3*(i % 32));
+        cv::RNG cvRng(seed * 7919u + unsigned(i));
+        for (auto&& kp : keypoints[i]) {
+            const double s = std::max(1.0, double(kp.ComputeScale()));
+            const cv::Scalar color(cvRng.uniform(0, 256), cvRng.uniform(0, 256), cvRng.uniform(0, 256));
+            cv::ellipse(image, cv::Point2f(kp.x, kp.y), cv::Size(int(2*s + 1), int(s + 1)),
+                        kp.ComputeOrientation() * 180.0 / M_PI, 0, 360, color, -1, cv::LINE_AA);
+        }
+        const std::string path = imageFolder + "/" + imageName(i);
+        TraceStage stage("encode");
+        stage.AddBytes(image.rows * image.step);
+        if (!cv::imwrite(path, image, {cv::IMWRITE_JPEG_QUALITY, 90})) {
+            std::cerr << "Unable to write '" << path << "'!\n";
+            exit(-1);
+        }
+    }
+
+    colmap::Database database(databasePath);
+    colmap::DatabaseTransaction transaction(&database);
+
+    Reconstruction reconstruction;
+
+    colmap::Camera camera;
+    camera.InitializeWithName("SIMPLE_RADIAL", 1.2 * std::max(width, height), width, height);
+    camera.SetCameraId(database.WriteCamera(camera));
+    reconstruction.cameras.emplace(camera.CameraId(), camera);
+
+    std::vector<colmap::image_t> imageIds(numImages);
+    {
+        std::normal_distribution<double> normal(0.0, 1.0);
+        for (int i = 0; i < numImages; i++) {
+            colmap::Image image;
+            image.SetName(imageName(i));
+            image.SetCameraId(camera.CameraId());
+            image.Qvec() = Eigen::Vector4d(normal(rng), normal(rng), normal(rng), normal(rng));
+            image.NormalizeQvec();
+            image.Tvec() = Eigen::Vector3d(normal(rng), normal(rng), normal(rng));
+            imageIds[i] = database.WriteImage(image);
+            image.SetImageId(imageIds[i]);
+            database.WriteKeypoints(imageIds[i], keypoints[i]);
+            database.WriteDescriptors(imageIds[i], descriptors[i]);
+
+            std::vector<Eigen::Vector2d> points2D;
+            points2D.reserve(numKeypoints);
+            for (auto&& kp : keypoints[i])
+                points2D.emplace_back(kp.x, kp.y);
+            image.SetPoints2D(points2D);
+            image.SetRegistered(true);
+            reconstruction.images.emplace(imageIds[i], image);
+        }
+    }
+
+    //
+    // 3D points for the scene points seen by at least two images.
+    //
+    {
+        std::uniform_real_distribution<double> coordinate(-10.0, 10.0);
+        std::uniform_int_distribution<int> color(0, 255);
+        colmap::point3D_t point3DId = 1;
+        for (auto&& kv : tracks) {
+            if (kv.second.size() < 2) continue;
+            colmap::Point3D point3D;
+            point3D.XYZ() = Eigen::Vector3d(coordinate(rng), coordinate(rng), coordinate(rng));
+            point3D.Color() = Eigen::Matrix<uint8_t,3,1>(color(rng), color(rng), color(rng));
+            point3D.SetError(0.5);
+            for (auto&& observation : kv.second) {
+                const colmap::image_t imageId = imageIds[observation.first];
+                point3D.Track().AddElement(imageId, observation.second);
+                reconstruction.images.at(imageId).SetPoint3DForPoint2D(observation.second, point3DId);
+            }
+            reconstruction.points3D.emplace(point3DId, point3D);
+            point3DId++;
+        }
+    }
+
+    //
+    // Raw matches and two view geometries.
+    //
+    size_t numPairs = 0, numMatches = 0, numInliers = 0;
+    {
+        std::bernoulli_distribution matched(std::min(1.0, std::max(0.0, matchDensity)));
+        std::uniform_int_distribution<int> keypoint(0, numKeypoints - 1);
+        for (int a = 0; a < numImages; a++) {
+            for (int b = a + 1; b < numImages; b++) {
+                if (b - a > trackLength && !matched(rng)) continue;
+                colmap::FeatureMatches inliers;
+                auto iterA = observations[a].begin(), iterB = observations[b].begin();
+                while (iterA != observations[a].end() && iterB != observations[b].end()) {
+                    if (iterA->first < iterB->first) iterA++;
+                    else if (iterB->first < iterA->first) iterB++;
+                    else {
+                        inliers.emplace_back(iterA->second, iterB->second);
+                        iterA++;
+                        iterB++;
+                    }
+                }
+                const size_t numOutliers = inliers.empty() ?
+                    size_t(numKeypoints / 100) : size_t(inliers.size() * (1 - inlierRatio) / inlierRatio);
+                colmap::FeatureMatches matches = inliers;
+                for (size_t k = 0; k < numOutliers; k++)
+                    matches.emplace_back(keypoint(rng), keypoint(rng));
+                std::shuffle(matches.begin(), matches.end(), rng);
+                if (matches.empty()) continue;
+                database.WriteMatches(imageIds[a], imageIds[b], matches);
+                if (!inliers.empty()) {
+                    colmap::TwoViewGeometry twoViewGeometry;
+                    twoViewGeometry.config = colmap::TwoViewGeometry::CALIBRATED;
+                    twoViewGeometry.inlier_matches = inliers;
+                    database.WriteTwoViewGeometry(imageIds[a], imageIds[b], twoViewGeometry);
+                }
+                numPairs++;
+                numMatches += matches.size();
+                numInliers += inliers.size();
+            }
+        }
+    }
+
+    {
+        TraceStage stage("reconstruction write");
+        reconstruction.WriteBinary(sparseFolder);
+        stage.AddRows(reconstruction.points3D.size());
+    }
+
+    std::cout << "images ...................... " << numImages << "\n"
+              << "keypoints ................... " << size_t(numImages) * numKeypoints << "\n"
+              << "matched image pairs ......... " << numPairs << "\n"
+              << "matches ..................... " << numMatches << "\n"
+              << "inlier matches .............. " << numInliers << "\n"
+              << "3D points ................... " << reconstruction.points3D.size() << "\n";
+
+    return 0;
+}
@@ -0,0 +1,324 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <thread>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <unistd.h>
+#include "feature-reader.h"
+#include "matchability-model.h"
+#include "instrumentation.h"
+
+//
+// Trains a matchability model on the features CSV written by feature-data
+// and writes it in the format score-features loads. The CSV is streamed
+// in blocks for every pass and never held in memory: a first pass
+// computes the input standardization and the class balance, then each
+// epoch runs Hogwild SGD -- the threads update the shared weights
+// without locking, which is fine since each row touches a dense but
+// small set of weights and collisions are rare and benign.
+//
+// Positive and negative rows are weighted so that both classes
+// contribute equally, since only a small fraction of the keypoints
+// typically ends up matched.
+//
+int main(int argc, char *argv[]) {
+    size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t blockRows = 1 << 16;
+    int epochs = 5;
+    int hidden = 0;
+    double learningRate = 0.01;
+    double l2 = 1e-6;
+    std::string label = "inliers";
+    std::string basisPath;
+    int pcaDims = 32;
+
+    auto usage = [&]() {
+        std::cerr << "usage: " << argv[0] << " [-j threads] [-b block-rows] [-e epochs] [-r learning-rate] "
+                  << "[-w l2] [-H hidden-units] [-l matches|inliers|has3D] [-p pca-basis.bin [-d dims]] "
+                  << "[-t trace.json] features.csv model.bin\n";
+        exit(-1);
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:b:e:r:w:H:l:p:d:t:")) != -1) {
+        switch (opt) {
+        case 'j': numThreads = std::max(1, std::atoi(optarg)); break;
+        case 'b': blockRows = std::max(1, std::atoi(optarg)); break;
+        case 'e': epochs = std::max(1, std::atoi(optarg)); break;
+        case 'r': learningRate = std::atof(optarg); break;
+        case 'w': l2 = std::atof(optarg); break;
+        case 'H': hidden = std::max(0, std::atoi(optarg)); break;
+        case 'l': label = optarg; break;
+        case 'p': basisPath = optarg; break;
+        case 'd': pcaDims = std::atoi(optarg); break;
+        case 't': enableTrace(optarg); break;
+        default: usage();
+        }
+    }
+    if (argc - optind != 2 || (label != "matches" && label != "inliers" && label != "has3D"))
+        usage();
+    if (pcaDims < 1 || pcaDims > 128) {
+        std::cerr << "PCA dims must be in 1..128\n";
+        exit(-1);
+    }
+
+    const std::string featuresCSV(argv[optind]);
+    const std::string modelPath(argv[optind+1]);
+
+    auto isPositive = [&](const FeatureRow& row) {
+        if (label == "matches") return row.matches > 0;
+        if (label == "inliers") return row.inlierMatches > 0;
+        return row.hasPoint3D;
+    };
+
+    MatchabilityModel model;
+    if (!basisPath.empty()) {
+        DescriptorBasis basis;
+        if (!basis.Read(basisPath)) {
+            std::cerr << "Unable to read PCA basis '" << basisPath << "'\n";
+            exit(-1);
+        }
+        model.pcaDims = pcaDims;
+        model.pcaMean = basis.mean;
+        model.pcaComponents.assign(basis.components.begin(), basis.components.begin() + size_t(pcaDims)*128);
+    }
+    const int D = model.NumInputs();
+
+    //
+    // Streams the CSV once, calling work(thread, rows, n) on each thread's
+    // share of every block after it has been parsed. Returns the number
+    // of rows read; malformed rows are dropped.
+    //
+    std::vector<std::vector<FeatureRow>> threadRows(numThreads);
+    size_t malformed = 0;
+    auto pass = [&](const char* name, auto&& work) {
+        FeatureReader reader(featuresCSV);
+        if (!reader.IsOpen()) {
+            std::cerr << "Unable to open '" << featuresCSV << "'\n";
+            exit(-1);
+        }
+        TraceStage stage(name);
+        FeatureBlock block;
+        std::vector<size_t> dropped(numThreads);
+        size_t total = 0;
+        while (size_t n = reader.ReadBlock(block, blockRows)) {
+            auto chunk = [&](size_t t) {
+                const size_t begin = n * t / numThreads;
+                const size_t end = n * (t + 1) / numThreads;
+                std::vector<FeatureRow>& rows = threadRows[t];
+                rows.resize(end - begin);
+                size_t m = 0;
+                for (size_t i = begin; i < end; i++)
+                    if (parseFeatureRow(block.LineBegin(i), block.LineEnd(i), rows[m]))
+                        m++;
+                dropped[t] += (end - begin) - m;
+                work(t, rows.data(), m);
+            };
+            std::vector<std::thread> threads;
+            for (size_t t = 1; t < numThreads; t++)
+                threads.emplace_back(chunk, t);
+            chunk(0);
+            for (auto&& thread : threads)
+                thread.join();
+            total += n;
+            std::cout << "\r" << name << ": " << total << " rows" << std::flush;
+        }
+        std::cout << "\n";
+        stage.AddRows(total);
+        stage.AddBytes(reader.BytesRead());
+        malformed = std::accumulate(dropped.begin(), dropped.end(), size_t(0));
+        return total;
+    };
+
+    //
+    // Statistics pass: mean and standard deviation of every input and
+    // the number of positives. Per-thread sums are merged at the end.
+    //
+    struct InputStats {
+        std::vector<double> sum, sumSquares;
+        size_t count = 0, positives = 0;
+    };
+    std::vector<InputStats> stats(numThreads);
+    for (auto&& s : stats) {
+        s.sum.assign(D, 0);
+        s.sumSquares.assign(D, 0);
+    }
+    pass("statistics", [&](size_t t, const FeatureRow* rows, size_t n) {
+        InputStats& s = stats[t];
+        std::vector<float> x(D);
+        for (size_t i = 0; i < n; i++) {
+            model.Inputs(rows[i], x.data());
+            for (int k = 0; k < D; k++) {
+                s.sum[k] += x[k];
+                s.sumSquares[k] += double(x[k]) * x[k];
+            }
+            s.count++;
+            if (isPositive(rows[i])) s.positives++;
+        }
+    });
+    if (malformed > 0)
+        std::cerr << "warning: " << malformed << " malformed rows skipped\n";
+
+    size_t count = 0, positives = 0;
+    for (auto&& s : stats) {
+        count += s.count;
+        positives += s.positives;
+    }
+    if (positives == 0 || positives == count) {
+        std::cerr << "Need both positive and negative rows to train (" << positives << " of "
+                  << count << " rows are positive)\n";
+        exit(-1);
+    }
+    model.inputMean.resize(D);
+    model.inputStd.resize(D);
+    for (int k = 0; k < D; k++) {
+        double sum = 0, sumSquares = 0;
+        for (auto&& s : stats) {
+            sum += s.sum[k];
+            sumSquares += s.sumSquares[k];
+        }
+        const double mean = sum / count;
+        const double variance = std::max(sumSquares / count - mean * mean, 0.0);
+        model.inputMean[k] = float(mean);
+        model.inputStd[k] = variance > 1e-12 ? float(std::sqrt(variance)) : 1.0f;
+    }
+    const double positiveWeight = 0.5 * count / positives;
+    const double negativeWeight = 0.5 * count / (count - positives);
+    std::cout << positives << " of " << count << " rows positive (" << label << "), class weights "
+              << positiveWeight << " / " << negativeWeight << "\n";
+
+    //
+    // Logistic regression, or one ReLU hidden layer with -H. Hidden
+    // weights start with He initialization, the output weights at zero.
+    //
+    {
+        std::mt19937 rng(12345);
+        if (hidden > 0) {
+            MatchabilityModel::Layer first, output;
+            first.in = D;
+            first.out = hidden;
+            first.weights.resize(size_t(D) * hidden);
+            std::normal_distribution<float> normal(0.0f, std::sqrt(2.0f / D));
+            for (auto&& w : first.weights)
+                w = normal(rng);
+            first.bias.assign(hidden, 0.0f);
+            output.in = hidden;
+            output.out = 1;
+            output.weights.assign(hidden, 0.0f);
+            output.bias.assign(1, 0.0f);
+            model.layers = {first, output};
+        } else {
+            MatchabilityModel::Layer output;
+            output.in = D;
+            output.out = 1;
+            output.weights.assign(D, 0.0f);
+            output.bias.assign(1, 0.0f);
+            model.layers = {output};
+        }
+    }
+
+    //
+    // SGD epochs. Each thread visits its share of a block in random order.
+    // The reported loss is the class-weighted log loss of every row
+    // evaluated just before it is trained on.
+    //
+    std::vector<double> threadLoss(numThreads);
+    for (int epoch = 0; epoch < epochs; epoch++) {
+        const float rate = float(learningRate / (1.0 + epoch));
+        std::fill(threadLoss.begin(), threadLoss.end(), 0.0);
+        const std::string name = "epoch " + std::to_string(epoch + 1);
+        pass(name.c_str(), [&](size_t t, const FeatureRow* rows, size_t n) {
+            std::mt19937 rng(unsigned(epoch * 7919 + t));
+            std::vector<uint32_t> order(n);
+            std::iota(order.begin(), order.end(), 0);
+            std::shuffle(order.begin(), order.end(), rng);
+
+            std::vector<float> x(D), h(hidden), gradient(hidden);
+            double loss = 0;
+            for (uint32_t i : order) {
+                const FeatureRow& row = rows[i];
+                model.Inputs(row, x.data());
+                for (int k = 0; k < D; k++)
+                    x[k] = (x[k] - model.inputMean[k]) / model.inputStd[k];
+
+                MatchabilityModel::Layer& output = model.layers.back();
+                const float* input = x.data();
+                if (hidden > 0) {
+                    const MatchabilityModel::Layer& first = model.layers.front();
+                    for (int j = 0; j < hidden; j++) {
+                        const float* W = &first.weights[size_t(j) * D];
+                        float sum = first.bias[j];
+                        for (int k = 0; k < D; k++)
+                            sum += W[k] * x[k];
+                        h[j] = std::max(sum, 0.0f);
+                    }
+                    input = h.data();
+                }
+                float z = output.bias[0];
+                for (int k = 0; k < output.in; k++)
+                    z += output.weights[k] * input[k];
+                const float p = 1.0f / (1.0f + std::exp(-z));
+
+                const bool positive = isPositive(row);
+                const float weight = float(positive ? positiveWeight : negativeWeight);
+                loss -= weight * std::log(std::max(positive ? p : 1.0f - p, 1e-7f));
+
+                // d(loss)/dz of the weighted log loss
+                const float delta = weight * (p - (positive ? 1.0f : 0.0f));
+                if (hidden > 0) {
+                    for (int j = 0; j < hidden; j++)
+                        gradient[j] = h[j] > 0 ? delta * output.weights[j] : 0.0f;
+                }
+                for (int k = 0; k < output.in; k++)
+                    output.weights[k] -= rate * (delta * input[k] + float(l2) * output.weights[k]);
+                output.bias[0] -= rate * delta;
+                if (hidden > 0) {
+                    MatchabilityModel::Layer& first = model.layers.front();
+                    for (int j = 0; j < hidden; j++) {
+                        if (gradient[j] == 0.0f) continue;
+                        float* W = &first.weights[size_t(j) * D];
+                        for (int k = 0; k < D; k++)
+                            W[k] -= rate * (gradient[j] * x[k] + float(l2) * W[k]);
+                        first.bias[j] -= rate * gradient[j];
+                    }
+                }
+            }
+            threadLoss[t] += loss;
+        });
+        const double loss = std::accumulate(threadLoss.begin(), threadLoss.end(), 0.0) / count;
+        std::cout << name << ": weighted log loss " << loss << "\n";
+        traceCounter("epochs", 1);
+    }
+
+    if (!model.Write(modelPath)) {
+        std::cerr << "Unable to write '" << modelPath << "'\n";
+        exit(-1);
+    }
+    std::cout << "wrote " << modelPath << " (" << D << " inputs, "
+              << (hidden > 0 ? std::to_string(hidden) + " hidden units" : std::string("logistic regression"))
+              << ")\n";
+
+    //
+    // Checks the scorer that score-features uses, with its folded and
+    // quantized first layer, against the float model on the training rows.
+    //
+    const MatchabilityScorer scorer(model);
+    std::vector<double> threadDifference(numThreads);
+    pass("check", [&](size_t t, const FeatureRow* rows, size_t n) {
+        std::vector<float> scores(n);
+        scorer.Score(rows, n, scores.data());
+        for (size_t i = 0; i < n; i++)
+            threadDifference[t] = std::max(threadDifference[t], double(std::abs(scores[i] - model.Predict(rows[i]))));
+    });
+    const double difference = *std::max_element(threadDifference.begin(), threadDifference.end());
+    std::cout << "largest difference of the scorer from the float model " << difference << "\n";
+    if (difference > 1e-3)
+        std::cerr << "warning: the scorer differs from the float model by up to " << difference << "\n";
+
+    return 0;
+}